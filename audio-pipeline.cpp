@@ -0,0 +1,214 @@
+#include "audio-pipeline.hpp"
+#include "config.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <log/log.hpp>
+
+namespace
+{
+  const auto SampleSpec = pa_sample_spec{.format = PA_SAMPLE_S16LE, .rate = 48000, .channels = 2};
+} // namespace
+
+AudioPipeline::AudioPipeline(StreamMetrics &metrics, OnPacket onPacket)
+  : onPacket(std::move(onPacket)), metrics(metrics), frameSize(config().audioFrame), pcm(frameSize * SampleSpec.channels)
+{
+  initEncoder();
+  initAudio();
+}
+
+AudioPipeline::~AudioPipeline()
+{
+  // Stopping joins the mainloop thread, so no callback runs past this point
+  if (mainloop)
+    pa_threaded_mainloop_stop(mainloop);
+
+  if (stream)
+  {
+    pa_stream_disconnect(stream);
+    pa_stream_unref(stream);
+    stream = nullptr;
+  }
+
+  if (context)
+  {
+    pa_context_disconnect(context);
+    pa_context_unref(context);
+    context = nullptr;
+  }
+
+  if (mainloop)
+  {
+    pa_threaded_mainloop_free(mainloop);
+    mainloop = nullptr;
+  }
+
+  if (opusEncoder)
+  {
+    opus_encoder_destroy(opusEncoder);
+    opusEncoder = nullptr;
+  }
+}
+
+auto AudioPipeline::initEncoder() -> void
+{
+  // Below 10 ms Opus runs CELT only; the restricted low delay mode drops the
+  // SILK lookahead it could not use anyway, 4 ms less algorithmic delay
+  const auto application = frameSize < 480 ? OPUS_APPLICATION_RESTRICTED_LOWDELAY : OPUS_APPLICATION_AUDIO;
+  int opusError;
+  opusEncoder = opus_encoder_create(SampleSpec.rate, SampleSpec.channels, application, &opusError);
+  if (opusError != OPUS_OK)
+  {
+    LOG("Failed to create Opus encoder:", opus_strerror(opusError));
+    exit(1);
+  }
+  opus_encoder_ctl(opusEncoder, OPUS_SET_BITRATE(config().audioBitrate * 1000));
+  opus_encoder_ctl(opusEncoder, OPUS_SET_DTX(config().audioDtx ? 1 : 0));
+  // In-band FEC is a SILK feature and needs 10 ms frames or longer
+  if (config().audioFec && frameSize < 480)
+    LOG("Opus FEC needs an audio frame of 10 ms or more, it is left off");
+  else if (config().audioFec)
+  {
+    opus_encoder_ctl(opusEncoder, OPUS_SET_INBAND_FEC(1));
+    opus_encoder_ctl(opusEncoder, OPUS_SET_PACKET_LOSS_PERC(10));
+  }
+}
+
+auto AudioPipeline::initAudio() -> void
+{
+  LOG("Initialize PulseAudio for audio capture,", frameSize * 1000 / (SampleSpec.rate / 1000), "us frames");
+
+  mainloop = pa_threaded_mainloop_new();
+  if (!mainloop)
+  {
+    LOG("pa_threaded_mainloop_new() failed");
+    exit(1);
+  }
+  context = pa_context_new(pa_threaded_mainloop_get_api(mainloop), "Screen Cast");
+  if (!context)
+  {
+    LOG("pa_context_new() failed");
+    exit(1);
+  }
+  pa_context_set_state_callback(context, onContextState, this);
+  if (pa_context_connect(context, nullptr, PA_CONTEXT_NOFLAGS, nullptr) < 0)
+  {
+    LOG("pa_context_connect() failed:", pa_strerror(pa_context_errno(context)));
+    exit(1);
+  }
+  // The stream is set up from the context callback once the server answered
+  if (pa_threaded_mainloop_start(mainloop) < 0)
+  {
+    LOG("pa_threaded_mainloop_start() failed");
+    exit(1);
+  }
+}
+
+auto AudioPipeline::onContextState(pa_context *context, void *userdata) -> void
+{
+  const auto self = static_cast<AudioPipeline *>(userdata);
+  switch (pa_context_get_state(context))
+  {
+  case PA_CONTEXT_READY: self->startRecording(); break;
+  case PA_CONTEXT_FAILED: LOG("PulseAudio connection failed:", pa_strerror(pa_context_errno(context))); break;
+  default: break;
+  }
+}
+
+auto AudioPipeline::startRecording() -> void
+{
+  stream = pa_stream_new(context, "record", &SampleSpec, nullptr);
+  if (!stream)
+  {
+    LOG("pa_stream_new() failed:", pa_strerror(pa_context_errno(context)));
+    return;
+  }
+  pa_stream_set_state_callback(stream, onStreamState, this);
+  pa_stream_set_read_callback(stream, onStreamRead, this);
+
+  pa_buffer_attr bufferAttr;
+  bufferAttr.maxlength = (uint32_t)-1; // Default maximum buffer size
+  bufferAttr.tlength = (uint32_t)-1;   // Not used for recording
+  bufferAttr.prebuf = (uint32_t)-1;    // Not used for recording
+  bufferAttr.minreq = (uint32_t)-1;    // Not used for recording
+  // One Opus frame; with PA_STREAM_ADJUST_LATENCY the server also sizes the
+  // source latency to it instead of its default of up to 2 s
+  bufferAttr.fragsize = static_cast<uint32_t>(pcm.size() * sizeof(int16_t));
+
+  if (pa_stream_connect_record(stream, "@DEFAULT_SINK@.monitor", &bufferAttr, PA_STREAM_ADJUST_LATENCY) < 0)
+    LOG("pa_stream_connect_record() failed:", pa_strerror(pa_context_errno(context)));
+}
+
+auto AudioPipeline::onStreamState(pa_stream *stream, void *) -> void
+{
+  if (pa_stream_get_state(stream) == PA_STREAM_FAILED)
+    LOG("PulseAudio record stream failed:", pa_strerror(pa_context_errno(pa_stream_get_context(stream))));
+}
+
+auto AudioPipeline::onStreamRead(pa_stream *stream, size_t, void *userdata) -> void
+{
+  const auto self = static_cast<AudioPipeline *>(userdata);
+  Trace::setThreadName("audio");
+  const auto span = TraceSpan{"audio read"};
+  while (pa_stream_readable_size(stream) > 0)
+  {
+    const void *data;
+    size_t nbytes;
+    if (pa_stream_peek(stream, &data, &nbytes) < 0)
+    {
+      LOG("pa_stream_peek() failed:", pa_strerror(pa_context_errno(pa_stream_get_context(stream))));
+      return;
+    }
+    if (nbytes == 0)
+      break;
+    self->feed(static_cast<const int16_t *>(data), nbytes / sizeof(int16_t));
+    pa_stream_drop(stream);
+  }
+}
+
+auto AudioPipeline::feed(const int16_t *samples, size_t n) -> void
+{
+  while (n > 0)
+  {
+    const auto chunk = std::min(n, pcm.size() - pcmSize);
+    if (samples)
+    {
+      std::copy_n(samples, chunk, std::begin(pcm) + pcmSize);
+      samples += chunk;
+    }
+    else
+      std::fill_n(std::begin(pcm) + pcmSize, chunk, 0);
+    pcmSize += chunk;
+    n -= chunk;
+    if (pcmSize < pcm.size())
+      break;
+    pcmSize = 0;
+
+    const auto frameDuration = std::chrono::microseconds{frameSize * 1'000'000LL / SampleSpec.rate};
+    // The fragment arrives once its last sample is recorded; start over from
+    // the clock after a gap in the stream or when the sample clock drifted off
+    const auto measured = std::chrono::steady_clock::now() - frameDuration;
+    if (std::chrono::abs(measured - nextFrameTime) > std::chrono::milliseconds{20})
+      nextFrameTime = measured;
+    const auto captureTime = nextFrameTime;
+    nextFrameTime += frameDuration;
+
+    auto message = Message::acquire();
+    const auto encodeStart = std::chrono::steady_clock::now();
+    const auto opusDataSize =
+      opus_encode(opusEncoder, pcm.data(), frameSize, message->inlineData(), Message::InlineCapacity);
+    const auto encodeEnd = std::chrono::steady_clock::now();
+    metrics.audioEncode.record(std::chrono::duration_cast<std::chrono::microseconds>(encodeEnd - encodeStart).count());
+    Trace::complete("opus encode", encodeStart, encodeEnd);
+    if (opusDataSize < 0)
+    {
+      LOG("Opus encoding failed:", opus_strerror(opusDataSize));
+      continue;
+    }
+    // 2 bytes or less is a DTX frame the decoder does not need
+    if (opusDataSize <= 2)
+      continue;
+    message->setInlineSize(opusDataSize);
+    const auto span = TraceSpan{"audio send"};
+    onPacket(std::move(message), captureTime);
+  }
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "message.hpp"
+#include "metrics.hpp"
+#include <chrono>
+#include <functional>
+#include <opus/opus.h>
+#include <vector>
+
+extern "C" {
+#include <pulse/pulseaudio.h>
+}
+
+// Records the default sink monitor through the asynchronous PulseAudio API
+// and encodes it to Opus on the PulseAudio mainloop thread. The record
+// fragment is one Opus frame, so a frame is encoded as soon as the server
+// hands it over.
+class AudioPipeline
+{
+public:
+  // Called on the PulseAudio thread for every Opus packet with the time its
+  // first sample was captured; the packet is encoded straight into the
+  // message's inline payload, the header is left to the receiver. Nothing is
+  // sent for frames DTX leaves out.
+  using OnPacket = std::function<void(MessageRef message, std::chrono::steady_clock::time_point captureTime)>;
+
+  AudioPipeline(StreamMetrics &metrics, OnPacket onPacket);
+  ~AudioPipeline();
+
+private:
+  static auto onContextState(pa_context *context, void *userdata) -> void;
+  static auto onStreamState(pa_stream *stream, void *userdata) -> void;
+  static auto onStreamRead(pa_stream *stream, size_t nbytes, void *userdata) -> void;
+  auto initAudio() -> void;
+  auto initEncoder() -> void;
+  auto startRecording() -> void;
+  // Appends PCM, nullptr for a hole in the stream, and encodes each full frame
+  auto feed(const int16_t *samples, size_t n) -> void;
+
+  OnPacket onPacket;
+  StreamMetrics &metrics;
+  pa_threaded_mainloop *mainloop = nullptr;
+  pa_context *context = nullptr;
+  pa_stream *stream = nullptr;
+  OpusEncoder *opusEncoder = nullptr;
+  const int frameSize; // samples per channel
+  std::vector<int16_t> pcm; // the Opus frame being filled, interleaved stereo
+  size_t pcmSize = 0;
+  // Capture time of the next frame, advanced by the frame duration so the
+  // timestamps do not pick up the jitter of the read callbacks
+  std::chrono::steady_clock::time_point nextFrameTime;
+};
@@ -3,10 +3,27 @@ class AudioProcessor extends AudioWorkletProcessor {
         super();
         // Initialize separate buffers for each channel
         this.buffers = [new Float32Array(0), new Float32Array(0)];
-        this.maxBufferLength = 8 * 1024;
+        // Bursts after a network stall would otherwise stay queued as latency
+        this.maxBufferLength = 4 * 1024;
+        this.targetBufferLength = 1024;
+        // PTS of the first buffered sample in microseconds
+        this.headPts = 0;
+        // Audio lagging the picture by more than this is skipped, around
+        // where lip sync errors become noticeable; microseconds
+        this.maxAudioLag = 40000;
 
         this.port.onmessage = (event) => {
-            const float32Array = new Float32Array(event.data);
+            const message = event.data;
+            if (message.type === 'reset') {
+                this.buffers = [new Float32Array(0), new Float32Array(0)];
+                return;
+            }
+            if (message.type === 'sync') {
+                this.sync(message.videoPts, message.outputLatency);
+                return;
+            }
+
+            const float32Array = new Float32Array(message.samples);
             const numChannels = 2; // Stereo
             const samplesPerChannel = float32Array.length / numChannels;
 
@@ -17,24 +34,51 @@ class AudioProcessor extends AudioWorkletProcessor {
                 newSamples[1][i] = float32Array[i * numChannels + 1];
             }
 
+            // After an underrun, e.g. a DTX gap, playback resumes at this packet
+            if (this.buffers[0].length === 0)
+                this.headPts = message.pts;
             for (let c = 0; c < numChannels; c++) {
-                // Check for overflow and clear buffer if necessary
-                if (this.buffers[c].length + newSamples[c].length > this.maxBufferLength) {
-                    console.log(`Buffer overflow detected on channel ${c}. Clearing buffer.`);
-                    this.buffers[c] = new Float32Array(0);
-                }
-
                 // Append new samples to the buffer
                 this.buffers[c] = concatFloat32Arrays(this.buffers[c], newSamples[c]);
             }
+
+            // On overflow drop the oldest samples, keeping the newest few ms
+            if (this.buffers[0].length > this.maxBufferLength) {
+                console.log('Buffer overflow detected. Dropping old samples.');
+                this.drop(this.buffers[0].length - this.targetBufferLength);
+            }
         };
     }
 
+    drop(n) {
+        for (let c = 0; c < this.buffers.length; c++)
+            this.buffers[c] = this.buffers[c].subarray(n);
+        this.headPts += n * 1e6 / sampleRate;
+    }
+
+    // Called as a video frame is drawn. The picture is shown as soon as it is
+    // decoded, so audio that fell behind it skips ahead; audio ahead of the
+    // picture plays on, holding it back would only add latency.
+    sync(videoPts, outputLatency) {
+        const length = this.buffers[0].length;
+        if (length === 0)
+            return;
+        const audiblePts = this.headPts - outputLatency * 1e6;
+        const lag = videoPts - audiblePts;
+        if (lag <= this.maxAudioLag)
+            return;
+        const n = Math.min(length, Math.round(lag * sampleRate / 1e6));
+        console.log(`Audio lags video by ${Math.round(lag / 1000)} ms, skipping ${n} samples`);
+        this.drop(n);
+    }
+
     process(inputs, outputs, parameters) {
         const output = outputs[0];
         const numChannels = output.length;
         const samplesPerChannel = output[0].length;
 
+        if (this.buffers[0].length >= samplesPerChannel)
+            this.headPts += samplesPerChannel * 1e6 / sampleRate;
         for (let c = 0; c < numChannels; c++) {
             if (this.buffers[c].length >= samplesPerChannel) {
                 // Copy samples to output
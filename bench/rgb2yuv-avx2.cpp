@@ -0,0 +1 @@
+../rgb2yuv-avx2.cpp
\ No newline at end of file
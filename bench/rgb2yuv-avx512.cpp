@@ -0,0 +1 @@
+../rgb2yuv-avx512.cpp
\ No newline at end of file
@@ -0,0 +1,569 @@
+// Benchmark and correctness suite for the color converter. Built on its own
+// from this directory, see README.md.
+#include "rgb2yuv.hpp"
+#include "worker-pool.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <log/log.hpp>
+#include <random>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+  // Picture in R, G, B order, the form the reference works on; packed into
+  // the converter's source formats per run
+  struct Picture
+  {
+    std::string name;
+    int width;
+    int height;
+    std::vector<uint8_t> rgb;
+  };
+
+  struct Planes
+  {
+    Planes(int w, int h)
+      : stride{(w + 63) / 64 * 64, (w / 2 + 63) / 64 * 64, (w / 2 + 63) / 64 * 64},
+        y(stride[0] * h),
+        u(stride[1] * h / 2),
+        v(stride[2] * h / 2),
+        data{y.data(), u.data(), v.data()}
+    {
+    }
+
+    int stride[3];
+    std::vector<uint8_t> y;
+    std::vector<uint8_t> u;
+    std::vector<uint8_t> v;
+    uint8_t *data[3];
+  };
+
+  struct Options
+  {
+    std::string mode = "all";
+    std::vector<Rgb2Yuv::Kernel> kernels;
+    std::vector<int> threads;
+    std::vector<std::pair<int, int>> sizes = {{1280, 720}, {1920, 1080}, {3840, 2160}};
+    std::vector<std::string> scales = {"full", "half"};
+    std::vector<std::string> frames;
+    double seconds = 0.2;
+  };
+
+  auto split(const std::string &v) -> std::vector<std::string>
+  {
+    auto ret = std::vector<std::string>{};
+    auto ss = std::istringstream{v};
+    for (auto item = std::string{}; std::getline(ss, item, ',');)
+      if (!item.empty())
+        ret.push_back(item);
+    return ret;
+  }
+
+  auto parseSize(const std::string &v) -> std::pair<int, int>
+  {
+    auto w = 0;
+    auto h = 0;
+    auto end = char{};
+    if (sscanf(v.c_str(), "%dx%d%c", &w, &h, &end) != 2 || w < 2 || h < 2)
+    {
+      LOG("Expected WxH, got", v);
+      exit(1);
+    }
+    return {w / 2 * 2, h / 2 * 2};
+  }
+
+  auto parseOptions(int argc, char **argv) -> Options
+  {
+    auto opts = Options{};
+    const auto options = std::unordered_map<std::string, std::function<void(const std::string &)>>{
+      {"mode",
+       [&](const std::string &v) {
+         if (v != "all" && v != "verify" && v != "bench")
+         {
+           LOG("Expected all, verify or bench for mode, got", v);
+           exit(1);
+         }
+         opts.mode = v;
+       }},
+      {"kernels",
+       [&](const std::string &v) {
+         opts.kernels.clear();
+         for (const auto &name : split(v))
+         {
+           const auto kernel = Rgb2Yuv::parseKernel(name);
+           if (!kernel)
+           {
+             LOG("Unknown color conversion kernel:", name);
+             exit(1);
+           }
+           if (!Rgb2Yuv::isSupported(*kernel))
+           {
+             LOG("Kernel", name, "is not supported by this CPU, skipping it");
+             continue;
+           }
+           opts.kernels.push_back(*kernel);
+         }
+       }},
+      {"threads",
+       [&](const std::string &v) {
+         opts.threads.clear();
+         for (const auto &n : split(v))
+           opts.threads.push_back(std::max(1, std::stoi(n)));
+       }},
+      {"sizes",
+       [&](const std::string &v) {
+         opts.sizes.clear();
+         for (const auto &size : split(v))
+           opts.sizes.push_back(parseSize(size));
+       }},
+      {"scales",
+       [&](const std::string &v) {
+         opts.scales = split(v);
+         for (const auto &scale : opts.scales)
+           if (scale != "full" && scale != "half" && scale != "bilinear")
+           {
+             LOG("Expected full, half or bilinear for scales, got", scale);
+             exit(1);
+           }
+       }},
+      {"frame", [&](const std::string &v) { opts.frames.push_back(v); }},
+      {"seconds", [&](const std::string &v) { opts.seconds = std::stod(v); }},
+    };
+
+    for (auto i = 1; i < argc; ++i)
+    {
+      const auto arg = std::string{argv[i]};
+      const auto eq = arg.find('=');
+      if (arg.rfind("--", 0) != 0 || eq == std::string::npos)
+      {
+        LOG("Expected --name=value, got", arg);
+        exit(1);
+      }
+      const auto it = options.find(arg.substr(2, eq - 2));
+      if (it == std::end(options))
+      {
+        LOG("Unknown option:", arg);
+        exit(1);
+      }
+      it->second(arg.substr(eq + 1));
+    }
+
+    if (opts.kernels.empty())
+      for (const auto kernel :
+           {Rgb2Yuv::Kernel::Scalar, Rgb2Yuv::Kernel::Sse41, Rgb2Yuv::Kernel::Avx2, Rgb2Yuv::Kernel::Avx512})
+        if (Rgb2Yuv::isSupported(kernel))
+          opts.kernels.push_back(kernel);
+    if (opts.threads.empty())
+    {
+      opts.threads.push_back(1);
+      if (const auto n = WorkerPool::defaultThreads() + 1; n > 1)
+        opts.threads.push_back(n);
+    }
+    return opts;
+  }
+
+  // Desktop-like content: flat panels, a gradient and sharp one-pixel text
+  // strokes, so every chroma pair sees both smooth and hard edges
+  auto makeDesktop(int w, int h) -> Picture
+  {
+    auto pic = Picture{"desktop", w, h, std::vector<uint8_t>(w * h * 3)};
+    for (auto y = 0; y < h; ++y)
+      for (auto x = 0; x < w; ++x)
+      {
+        const auto p = pic.rgb.data() + (y * w + x) * 3;
+        if (y < h / 16)
+        {
+          p[0] = 40;
+          p[1] = 44;
+          p[2] = 52;
+        }
+        else if (x < w / 5)
+        {
+          p[0] = static_cast<uint8_t>(x * 255 / (w / 5));
+          p[1] = static_cast<uint8_t>(y * 255 / h);
+          p[2] = 200;
+        }
+        else
+        {
+          const auto isStroke = (y / 3) % 6 < 4 && ((x * 7 + y * 3) % 11 == 0 || (x + y / 2) % 13 == 0);
+          const auto c = isStroke ? 20 : 245;
+          p[0] = static_cast<uint8_t>(c);
+          p[1] = static_cast<uint8_t>(isStroke && x % 3 == 0 ? 120 : c);
+          p[2] = static_cast<uint8_t>(c);
+        }
+      }
+    return pic;
+  }
+
+  // Saturated ramps of every primary and secondary, which is where wrong
+  // coefficients show most
+  auto makeGradient(int w, int h) -> Picture
+  {
+    auto pic = Picture{"gradient", w, h, std::vector<uint8_t>(w * h * 3)};
+    for (auto y = 0; y < h; ++y)
+      for (auto x = 0; x < w; ++x)
+      {
+        const auto band = y * 7 / h + 1; // 1..7 as a bit mask of R, G and B
+        const auto level = static_cast<uint8_t>(x * 255 / std::max(1, w - 1));
+        const auto p = pic.rgb.data() + (y * w + x) * 3;
+        p[0] = (band & 1) ? level : 0;
+        p[1] = (band & 2) ? level : 0;
+        p[2] = (band & 4) ? level : 0;
+      }
+    return pic;
+  }
+
+  auto makeNoise(int w, int h) -> Picture
+  {
+    auto pic = Picture{"noise", w, h, std::vector<uint8_t>(w * h * 3)};
+    auto rng = std::mt19937{static_cast<uint32_t>(w * 31 + h)};
+    for (auto &c : pic.rgb)
+      c = static_cast<uint8_t>(rng() >> 24);
+    return pic;
+  }
+
+  // Binary PPM (P6) with 8-bit samples, e.g. a screenshot saved with
+  // `import -window root shot.ppm`; cropped to even dimensions
+  auto loadPpm(const std::string &path) -> Picture
+  {
+    auto f = std::ifstream{path, std::ios::binary};
+    const auto token = [&]() {
+      auto ret = std::string{};
+      while (f >> std::ws && f.peek() == '#')
+        f.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+      f >> ret;
+      return ret;
+    };
+    if (!f || token() != "P6")
+    {
+      LOG("Could not read", path, "as a binary PPM");
+      exit(1);
+    }
+    const auto w = std::stoi(token());
+    const auto h = std::stoi(token());
+    if (token() != "255" || w < 2 || h < 2)
+    {
+      LOG(path, "must be an 8-bit PPM of at least 2x2");
+      exit(1);
+    }
+    f.get();
+    auto full = std::vector<uint8_t>(w * h * 3);
+    if (!f.read(reinterpret_cast<char *>(full.data()), full.size()))
+    {
+      LOG(path, "is truncated");
+      exit(1);
+    }
+
+    auto pic = Picture{path, w / 2 * 2, h / 2 * 2, {}};
+    pic.rgb.resize(pic.width * pic.height * 3);
+    for (auto y = 0; y < pic.height; ++y)
+      std::copy_n(full.data() + y * w * 3, pic.width * 3, pic.rgb.data() + y * pic.width * 3);
+    return pic;
+  }
+
+  auto bytesPerPixel(Rgb2Yuv::Format format) -> int
+  {
+    return format == Rgb2Yuv::Format::Bgrx32 ? 4 : 3;
+  }
+
+  auto formatName(Rgb2Yuv::Format format) -> const char *
+  {
+    return format == Rgb2Yuv::Format::Bgrx32 ? "bgrx" : "rgb24";
+  }
+
+  // Lays the picture out the way a capture backend hands it over
+  auto pack(const Picture &pic, Rgb2Yuv::Format format, Rgb2Yuv::RowOrder rowOrder) -> std::vector<uint8_t>
+  {
+    const auto bpp = bytesPerPixel(format);
+    auto ret = std::vector<uint8_t>(pic.width * pic.height * bpp, 0xff);
+    for (auto y = 0; y < pic.height; ++y)
+    {
+      const auto dstY = rowOrder == Rgb2Yuv::RowOrder::TopDown ? y : pic.height - y - 1;
+      for (auto x = 0; x < pic.width; ++x)
+      {
+        const auto s = pic.rgb.data() + (y * pic.width + x) * 3;
+        const auto d = ret.data() + (dstY * pic.width + x) * bpp;
+        if (format == Rgb2Yuv::Format::Bgrx32)
+        {
+          d[0] = s[2];
+          d[1] = s[1];
+          d[2] = s[0];
+        }
+        else
+          std::copy_n(s, 3, d);
+      }
+    }
+    return ret;
+  }
+
+  auto outputSize(int srcW, int srcH, const std::string &scale) -> std::pair<int, int>
+  {
+    if (scale == "half")
+      return {srcW / 4 * 2, srcH / 4 * 2};
+    if (scale == "bilinear")
+      return {srcW * 3 / 8 * 2, srcH * 3 / 8 * 2};
+    return {srcW, srcH};
+  }
+
+  // BT.601 studio range straight from the standard's coefficients, in floating
+  // point, so it shares nothing with the kernels' fixed-point math
+  struct Reference
+  {
+    Reference(const Picture &pic, int w, int h)
+      : width(w), height(h), y(w * h), u(w * h / 4), v(w * h / 4)
+    {
+      const auto at = [&](int x, int yy, int c) -> float { return pic.rgb[(yy * pic.width + x) * 3 + c]; };
+      const auto taps = [](int srcSize, int size, int i) {
+        const auto pos = std::clamp((i + 0.5f) * srcSize / size - 0.5f, 0.f, srcSize - 1.f);
+        const auto i0 = static_cast<int>(pos);
+        return std::make_tuple(i0, std::min(i0 + 1, srcSize - 1), pos - i0);
+      };
+      const auto sample = [&](int x, int yy, int c) -> float {
+        if (pic.width == w && pic.height == h)
+          return at(x, yy, c);
+        if (pic.width == 2 * w && pic.height == 2 * h)
+          return (at(2 * x, 2 * yy, c) + at(2 * x + 1, 2 * yy, c) + at(2 * x, 2 * yy + 1, c) +
+                  at(2 * x + 1, 2 * yy + 1, c)) /
+                 4;
+        const auto [x0, x1, fx] = taps(pic.width, w, x);
+        const auto [y0, y1, fy] = taps(pic.height, h, yy);
+        return (at(x0, y0, c) * (1 - fx) + at(x1, y0, c) * fx) * (1 - fy) +
+               (at(x0, y1, c) * (1 - fx) + at(x1, y1, c) * fx) * fy;
+      };
+
+      for (auto yy = 0; yy < h; yy += 2)
+        for (auto x = 0; x < w; x += 2)
+        {
+          auto sum = std::array<float, 3>{};
+          for (auto i = 0; i < 4; ++i)
+          {
+            const auto px = x + i % 2;
+            const auto py = yy + i / 2;
+            const auto r = sample(px, py, 0);
+            const auto g = sample(px, py, 1);
+            const auto b = sample(px, py, 2);
+            y[py * w + px] = 16 + (65.481f * r + 128.553f * g + 24.966f * b) / 255;
+            sum[0] += r;
+            sum[1] += g;
+            sum[2] += b;
+          }
+          const auto r = sum[0] / 4;
+          const auto g = sum[1] / 4;
+          const auto b = sum[2] / 4;
+          u[yy / 2 * w / 2 + x / 2] = 128 + (-37.797f * r - 74.203f * g + 112.f * b) / 255;
+          v[yy / 2 * w / 2 + x / 2] = 128 + (112.f * r - 93.786f * g - 18.214f * b) / 255;
+        }
+    }
+
+    int width;
+    int height;
+    std::vector<float> y;
+    std::vector<float> u;
+    std::vector<float> v;
+  };
+
+  // Largest difference of a plane from the reference
+  auto maxError(const std::vector<float> &ref, const uint8_t *plane, int stride, int w, int h) -> float
+  {
+    auto ret = 0.f;
+    for (auto y = 0; y < h; ++y)
+      for (auto x = 0; x < w; ++x)
+        ret = std::max(ret, std::abs(plane[y * stride + x] - ref[y * w + x]));
+    return ret;
+  }
+
+  // First byte where two outputs differ, as "plane x,y a != b"
+  auto firstMismatch(const Planes &a, const Planes &b, int w, int h) -> std::string
+  {
+    const auto planes = {std::make_tuple("Y", &Planes::y, 0, w, h),
+                         std::make_tuple("U", &Planes::u, 1, w / 2, h / 2),
+                         std::make_tuple("V", &Planes::v, 2, w / 2, h / 2)};
+    for (const auto &[name, plane, idx, pw, ph] : planes)
+      for (auto y = 0; y < ph; ++y)
+        for (auto x = 0; x < pw; ++x)
+        {
+          const auto va = (a.*plane)[y * a.stride[idx] + x];
+          const auto vb = (b.*plane)[y * b.stride[idx] + x];
+          if (va != vb)
+          {
+            auto ss = std::ostringstream{};
+            ss << name << " " << x << "," << y << " " << +va << " != " << +vb;
+            return ss.str();
+          }
+        }
+    return {};
+  }
+
+  // Every kernel must match the scalar kernel bit for bit, and the scalar
+  // kernel must stay within rounding of the floating-point reference
+  auto verify(const Options &opts, const std::vector<Picture> &recorded) -> bool
+  {
+    auto pool = WorkerPool{WorkerPool::defaultThreads()};
+    auto pictures = std::vector<Picture>{};
+    // Widths leave SIMD tails at full and half size
+    for (const auto &[w, h] : {std::pair{1372, 772}, std::pair{260, 100}, std::pair{1920, 1080}})
+    {
+      pictures.push_back(makeGradient(w, h));
+      pictures.push_back(makeNoise(w, h));
+      pictures.push_back(makeDesktop(w, h));
+    }
+    pictures.insert(std::end(pictures), std::begin(recorded), std::end(recorded));
+
+    auto nCases = 0;
+    auto nFailures = 0;
+    for (const auto &pic : pictures)
+      for (const auto &scale : {"full", "half", "bilinear"})
+      {
+        const auto [w, h] = outputSize(pic.width, pic.height, scale);
+        const auto ref = Reference{pic, w, h};
+        // The box filter rounds its samples once more and bilinear weights are
+        // quantized to 8 bits
+        const auto isUnscaled = w == pic.width && h == pic.height;
+        const auto isBilinear = !isUnscaled && (2 * w != pic.width || 2 * h != pic.height);
+        const auto lumaTolerance = isUnscaled ? 1.f : isBilinear ? 2.5f : 1.5f;
+        const auto chromaTolerance = isBilinear ? 3.f : 2.f;
+
+        for (const auto format : {Rgb2Yuv::Format::Bgrx32, Rgb2Yuv::Format::Rgb24})
+          for (const auto rowOrder : {Rgb2Yuv::RowOrder::TopDown, Rgb2Yuv::RowOrder::BottomUp})
+          {
+            const auto src = pack(pic, format, rowOrder);
+            const auto lineSize = pic.width * bytesPerPixel(format);
+            auto scalar = Planes{w, h};
+            Rgb2Yuv{pool, pic.width, pic.height, w, h, Rgb2Yuv::Kernel::Scalar}.convert(
+              src.data(), lineSize, format, rowOrder, scalar.data, scalar.stride);
+
+            const auto errY = maxError(ref.y, scalar.y.data(), scalar.stride[0], w, h);
+            const auto errU = maxError(ref.u, scalar.u.data(), scalar.stride[1], w / 2, h / 2);
+            const auto errV = maxError(ref.v, scalar.v.data(), scalar.stride[2], w / 2, h / 2);
+            const auto describe = [&]() {
+              auto ss = std::ostringstream{};
+              ss << pic.name << " " << pic.width << "x" << pic.height << " -> " << w << "x" << h << " "
+                 << formatName(format) << (rowOrder == Rgb2Yuv::RowOrder::BottomUp ? " bottom-up" : "");
+              return ss.str();
+            };
+            ++nCases;
+            if (errY > lumaTolerance || errU > chromaTolerance || errV > chromaTolerance)
+            {
+              ++nFailures;
+              std::cout << "FAIL " << describe() << ": scalar differs from BT.601 by Y " << errY << " U " << errU
+                        << " V " << errV << std::endl;
+            }
+
+            for (const auto kernel : opts.kernels)
+            {
+              if (kernel == Rgb2Yuv::Kernel::Scalar)
+                continue;
+              auto out = Planes{w, h};
+              Rgb2Yuv{pool, pic.width, pic.height, w, h, kernel}.convert(
+                src.data(), lineSize, format, rowOrder, out.data, out.stride);
+              ++nCases;
+              if (const auto mismatch = firstMismatch(out, scalar, w, h); !mismatch.empty())
+              {
+                ++nFailures;
+                std::cout << "FAIL " << describe() << ": " << Rgb2Yuv::kernelName(kernel)
+                          << " differs from scalar at " << mismatch << std::endl;
+              }
+            }
+          }
+      }
+
+    std::cout << "Verified " << nCases << " conversions, " << nFailures << " failed" << std::endl;
+    return nFailures == 0;
+  }
+
+  auto bench(const Options &opts, const std::vector<Picture> &recorded) -> void
+  {
+    auto pictures = std::vector<Picture>{};
+    for (const auto &[w, h] : opts.sizes)
+      pictures.push_back(makeDesktop(w, h));
+    pictures.insert(std::end(pictures), std::begin(recorded), std::end(recorded));
+
+    // GB/s counts the source read plus the planes written; ns/px is wall time
+    // per output pixel
+    printf("%-8s %-6s %-10s %-10s %-7s %-10s %9s %8s %8s\n",
+           "kernel",
+           "format",
+           "source",
+           "output",
+           "threads",
+           "picture",
+           "ms/frame",
+           "GB/s",
+           "ns/px");
+    for (const auto nThreads : opts.threads)
+    {
+      auto pool = WorkerPool{nThreads - 1};
+      for (const auto &pic : pictures)
+        for (const auto &scale : opts.scales)
+          for (const auto format : {Rgb2Yuv::Format::Bgrx32, Rgb2Yuv::Format::Rgb24})
+          {
+            const auto src = pack(pic, format, Rgb2Yuv::RowOrder::TopDown);
+            const auto lineSize = pic.width * bytesPerPixel(format);
+            const auto [w, h] = outputSize(pic.width, pic.height, scale);
+            for (const auto kernel : opts.kernels)
+            {
+              auto out = Planes{w, h};
+              auto rgb2Yuv = Rgb2Yuv{pool, pic.width, pic.height, w, h, kernel};
+              const auto run = [&]() {
+                rgb2Yuv.convert(src.data(), lineSize, format, Rgb2Yuv::RowOrder::TopDown, out.data, out.stride);
+              };
+              // Warm up the caches, the page tables of the output and the workers
+              for (auto i = 0; i < 3; ++i)
+                run();
+
+              auto nFrames = 0;
+              const auto start = std::chrono::steady_clock::now();
+              auto elapsed = 0.;
+              do
+              {
+                run();
+                ++nFrames;
+                elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+              } while (elapsed < opts.seconds);
+
+              const auto perFrame = elapsed / nFrames;
+              const auto bytes = static_cast<double>(src.size()) + w * h * 3 / 2;
+              const auto srcSize = std::to_string(pic.width) + "x" + std::to_string(pic.height);
+              const auto dstSize = std::to_string(w) + "x" + std::to_string(h);
+              printf("%-8s %-6s %-10s %-10s %-7d %-10s %9.3f %8.2f %8.3f\n",
+                     Rgb2Yuv::kernelName(kernel),
+                     formatName(format),
+                     srcSize.c_str(),
+                     dstSize.c_str(),
+                     nThreads,
+                     pic.name.c_str(),
+                     perFrame * 1e3,
+                     bytes / perFrame / 1e9,
+                     perFrame * 1e9 / (w * h));
+              fflush(stdout);
+            }
+          }
+    }
+  }
+} // namespace
+
+auto main(int argc, char **argv) -> int
+{
+  const auto opts = parseOptions(argc, argv);
+  auto recorded = std::vector<Picture>{};
+  for (const auto &path : opts.frames)
+    recorded.push_back(loadPpm(path));
+
+  if (opts.mode != "bench" && !verify(opts, recorded))
+    return 1;
+  if (opts.mode != "verify")
+    bench(opts, recorded);
+  return 0;
+}
@@ -0,0 +1 @@
+../rgb2yuv-kernels.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../rgb2yuv-scalar.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../rgb2yuv-sse41.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../rgb2yuv.cpp
\ No newline at end of file
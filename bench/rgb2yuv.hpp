@@ -0,0 +1 @@
+../rgb2yuv.hpp
\ No newline at end of file
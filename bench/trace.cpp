@@ -0,0 +1 @@
+../trace.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../trace.hpp
\ No newline at end of file
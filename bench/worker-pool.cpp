@@ -0,0 +1 @@
+../worker-pool.cpp
\ No newline at end of file
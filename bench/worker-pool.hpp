@@ -0,0 +1 @@
+../worker-pool.hpp
\ No newline at end of file
@@ -0,0 +1,156 @@
+#include "broadcast.hpp"
+#include "config.hpp"
+#include "media-header.hpp"
+#include "web-socket-session.hpp"
+#include <algorithm>
+#include <atomic>
+#include <log/log.hpp>
+
+namespace
+{
+  auto nextStreamId = std::atomic<uint8_t>{0};
+} // namespace
+
+Broadcast::Broadcast(const VideoEncoder::Backend &backend)
+  : streamId(nextStreamId.fetch_add(1)), startTime(std::chrono::steady_clock::now()), metrics(registerStream(backend.name))
+{
+  if (config().adaptiveRate)
+    rateController.emplace(config().crf, config().crfMin, config().crfMax, config().fps);
+  // onVideo() may run before make_unique returns and reads video under mutex
+  auto lock = std::unique_lock{mutex};
+  const auto &c = config();
+  video = std::make_unique<VideoPipeline>(startTime,
+                                          *metrics,
+                                          backend,
+                                          c.captureX,
+                                          c.captureY,
+                                          c.captureWidth,
+                                          c.captureHeight,
+                                          c.width,
+                                          c.height,
+                                          [this](AVPacket *pkt, bool isFrameEnd) { return onVideo(pkt, isFrameEnd); });
+  audio = std::make_unique<AudioPipeline>(*metrics, [this](MessageRef message, std::chrono::steady_clock::time_point captureTime) {
+    onAudio(std::move(message), captureTime);
+  });
+  cursor = std::make_unique<CursorPipeline>(
+    c.captureX,
+    c.captureY,
+    *metrics,
+    [this](MessageRef message) { onCursor(std::move(message), cursorShape); },
+    [this](MessageRef message) { onCursor(std::move(message), cursorPosition); });
+}
+
+Broadcast::~Broadcast()
+{
+  // Join the pipeline threads before the session list goes away
+  video.reset();
+  audio.reset();
+  cursor.reset();
+}
+
+auto Broadcast::shared(const VideoEncoder::Backend &backend) -> std::shared_ptr<Broadcast>
+{
+  static auto sharedMutex = std::mutex{};
+  static auto insts = std::unordered_map<const VideoEncoder::Backend *, std::weak_ptr<Broadcast>>{};
+  auto lock = std::unique_lock{sharedMutex};
+  auto &inst = insts[&backend];
+  auto ret = inst.lock();
+  if (!ret)
+  {
+    LOG("Start", backend.name, "broadcast");
+    ret = std::make_shared<Broadcast>(backend);
+    inst = ret;
+  }
+  return ret;
+}
+
+auto Broadcast::subscribe(WebSocketSession *session) -> void
+{
+  auto lock = std::unique_lock{mutex};
+  sessions.push_back(session);
+  LOG("Viewers:", sessions.size());
+  video->requestKeyframe();
+  for (const auto &message : {std::cref(cursorShape), std::cref(cursorPosition)})
+    if (message.get())
+      session->sendCursor(message);
+}
+
+auto Broadcast::unsubscribe(WebSocketSession *session) -> void
+{
+  auto lock = std::unique_lock{mutex};
+  sessions.erase(std::remove(std::begin(sessions), std::end(sessions), session), std::end(sessions));
+  LOG("Viewers:", sessions.size());
+}
+
+auto Broadcast::requestKeyframe() -> void
+{
+  video->requestKeyframe();
+}
+
+auto Broadcast::onVideo(AVPacket *pkt, bool isFrameEnd) -> bool
+{
+  const auto isFrameStart = std::exchange(this->isFrameStart, isFrameEnd);
+  const auto isKeyframe = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
+  if (isFrameStart)
+  {
+    ++videoSequence;
+    metrics->nFrames.fetch_add(1, std::memory_order_relaxed);
+    if (isKeyframe)
+      metrics->nKeyframes.fetch_add(1, std::memory_order_relaxed);
+  }
+  auto message = Message::acquire();
+  message->setType(0x01); // Video data identifier
+  auto header = MediaHeader{};
+  // Flags: bit 0 keyframe, the client cannot tell from the payload for every
+  // codec; bits 1 and 2 first and last part of a frame, which differ when
+  // slices are sent as they are encoded
+  header.flags = static_cast<uint8_t>((isKeyframe ? 0x01 : 0) | (isFrameStart ? 0x02 : 0) | (isFrameEnd ? 0x04 : 0));
+  header.streamId = streamId;
+  header.sequence = videoSequence;
+  header.pts = pkt->pts;
+  header.captureTime = toCaptureTime(startTime + std::chrono::microseconds{pkt->pts});
+  header.appendTo(*message);
+  message->takePacket(pkt);
+  auto needsKeyframe = false;
+  auto lock = std::unique_lock{mutex};
+  for (const auto session : sessions)
+    needsKeyframe |= session->sendVideo(message, isKeyframe, isFrameStart);
+
+  if (rateController && !sessions.empty() && isFrameEnd)
+  {
+    auto worst = LinkStats{};
+    for (const auto session : sessions)
+    {
+      const auto stats = session->linkStats();
+      worst.queuedVideo = std::max(worst.queuedVideo, stats.queuedVideo);
+      worst.bytesInFlight = std::max(worst.bytesInFlight, stats.bytesInFlight);
+      worst.rtt = std::max(worst.rtt, stats.rtt);
+      worst.nDrops += stats.nDrops;
+    }
+    if (const auto decision = rateController->update(worst))
+      video->setRate(decision->crf, decision->fps);
+  }
+  return needsKeyframe;
+}
+
+auto Broadcast::onAudio(MessageRef message, std::chrono::steady_clock::time_point captureTime) -> void
+{
+  message->setType(0x02); // Audio data identifier
+  auto header = MediaHeader{};
+  header.streamId = streamId;
+  header.sequence = ++audioSequence;
+  header.pts = std::chrono::duration_cast<std::chrono::microseconds>(captureTime - startTime).count();
+  header.captureTime = toCaptureTime(captureTime);
+  header.appendTo(*message);
+  auto lock = std::unique_lock{mutex};
+  for (const auto session : sessions)
+    session->sendAudio(message);
+}
+
+auto Broadcast::onCursor(MessageRef message, MessageRef &last) -> void
+{
+  auto lock = std::unique_lock{mutex};
+  for (const auto session : sessions)
+    session->sendCursor(message);
+  last = std::move(message);
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "audio-pipeline.hpp"
+#include "cursor-pipeline.hpp"
+#include "message.hpp"
+#include "metrics.hpp"
+#include "rate-controller.hpp"
+#include "video-pipeline.hpp"
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+class WebSocketSession;
+
+// Video and audio source feeding one or more WebSocket sessions. Packets are
+// encoded once, wrapped into a pooled message without copying and the same
+// message is queued on every subscribed session. In broadcast mode all sessions
+// that negotiated the same codec share one instance, otherwise each session
+// creates its own.
+class Broadcast
+{
+public:
+  Broadcast(const VideoEncoder::Backend &backend);
+  ~Broadcast();
+
+  // The instance shared by all sessions using the codec in broadcast mode; it
+  // is created by the first viewer and destroyed when the last one leaves
+  static auto shared(const VideoEncoder::Backend &backend) -> std::shared_ptr<Broadcast>;
+
+  // A late joiner gets a keyframe on demand and the current cursor
+  auto subscribe(WebSocketSession *session) -> void;
+  auto unsubscribe(WebSocketSession *session) -> void;
+  // A client lost its decoder state, e.g. after a decode error
+  auto requestKeyframe() -> void;
+
+private:
+  auto onAudio(MessageRef message, std::chrono::steady_clock::time_point captureTime) -> void;
+  auto onCursor(MessageRef message, MessageRef &last) -> void;
+  auto onVideo(AVPacket *pkt, bool isFrameEnd) -> bool;
+
+  // Tells the client its timestamps and sequence numbers start over
+  const uint8_t streamId;
+  // PTS zero for audio and video
+  const std::chrono::steady_clock::time_point startTime;
+  // Outlives the pipelines recording into it
+  const std::shared_ptr<StreamMetrics> metrics;
+  std::mutex mutex;
+  std::vector<WebSocketSession *> sessions;
+  // Runs on the encode thread under mutex; in broadcast mode the slowest viewer
+  // sets the pace for everyone since there is only one encoder
+  std::optional<RateController> rateController;
+  // The next video packet begins a frame; packets are slices in sliced mode.
+  // Only touched by the video callback, which never runs concurrently.
+  bool isFrameStart = true;
+  uint32_t videoSequence = 0; // only touched by the video callback
+  uint32_t audioSequence = 0; // only touched by the audio callback
+  std::unique_ptr<VideoPipeline> video;
+  std::unique_ptr<AudioPipeline> audio;
+  MessageRef cursorShape;    // guarded by mutex
+  MessageRef cursorPosition; // guarded by mutex
+  std::unique_ptr<CursorPipeline> cursor;
+};
@@ -0,0 +1,38 @@
+#include "capture.hpp"
+#include "config.hpp"
+#include "file-capture.hpp"
+#include "frame-scheduler.hpp"
+#include "screen-capture.hpp"
+#include "synthetic-capture.hpp"
+#include <log/log.hpp>
+
+auto Capture::waitIdle(FrameScheduler &scheduler) -> void
+{
+  scheduler.waitIdle(-1);
+}
+
+auto makeCapture(int x, int y, int width, int height, int nBuffers) -> std::unique_ptr<Capture>
+{
+  if (config().capture == "synthetic")
+  {
+    LOG("Capture source: synthetic", config().capturePattern, "pattern");
+    return std::make_unique<SyntheticCapture>(config().capturePattern, x, y, width, height, nBuffers);
+  }
+  if (config().capture == "file")
+    return FileCapture::create(config().captureFile, x, y, width, height);
+  return ScreenCapture::create(x, y, width, height, nBuffers);
+}
+
+auto headlessScreenSize() -> std::optional<std::pair<int, int>>
+{
+  if (config().capture == "synthetic")
+  {
+    // The synthetic screen ends where the capture rectangle does, if one is given
+    if (config().captureWidth > 0 && config().captureHeight > 0)
+      return std::pair{config().captureX + config().captureWidth, config().captureY + config().captureHeight};
+    return std::pair{1920, 1080};
+  }
+  if (config().capture == "file")
+    return FileCapture::probe(config().captureFile);
+  return std::nullopt;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "rgb2yuv.hpp"
+#include <memory>
+#include <optional>
+#include <utility>
+
+class FrameScheduler;
+
+// Picture source used by the capture stage of the video pipeline: the screen,
+// or a headless generator or file replay for benchmarks. Sources own a fixed
+// number of buffers, so a frame grabbed into one buffer stays intact while
+// later stages still read it and the next frame goes into another.
+class Capture
+{
+public:
+  struct Frame
+  {
+    uint8_t *pixels;
+    int lineSize;
+    Rgb2Yuv::Format format;
+    Rgb2Yuv::RowOrder rowOrder;
+  };
+
+  virtual ~Capture() = default;
+  virtual auto grab(int buffer) -> std::optional<Frame> = 0;
+  // Returns true if the picture may have changed since the previous poll;
+  // sources that cannot tell always do
+  virtual auto poll() -> bool { return true; }
+  // Sleeps for one idle period of the scheduler, or until the source learns
+  // of a change
+  virtual auto waitIdle(FrameScheduler &scheduler) -> void;
+};
+
+// Creates the source selected by --capture; nullptr if it cannot be set up.
+// Screen sources open their own X connection, and MIT-SHM falls back to GL
+// readback if the display does not support it.
+auto makeCapture(int x, int y, int width, int height, int nBuffers) -> std::unique_ptr<Capture>;
+// Size of the picture a headless source produces, which stands in for the
+// screen size; nullopt for the screen sources
+auto headlessScreenSize() -> std::optional<std::pair<int, int>>;
@@ -2,17 +2,214 @@ const canvas = document.getElementById('videoCanvas');
 const startButton = document.getElementById('startButton');
 const fullscreenToggle = document.getElementById('fullscreenToggle');
 const ctx = canvas.getContext('2d');
+const cursorCanvas = document.getElementById('cursorCanvas');
+const cursorCtx = cursorCanvas.getContext('2d');
 const maxTimeThreshold = 500; // milliseconds
 const maxDistanceThreshold = 20 * 20;
 
 let audioContext = null;
 let videoDecoder = null;
+// Decoder being created; frames arriving meanwhile wait for the same one
+let videoDecoderPending = null;
+let videoCodec = null; // WebCodecs codec string the server picked
+// Delta frames are useless until the next keyframe after a decoder reset
+let isWaitingForKeyframe = true;
+// Parts of a frame sent slice by slice, decoded together once the last arrives
+let frameParts = [];
+let isFramePartKey = false;
 let audioDecoder = null;
 let ws;
 let touchStartX = null;
 let touchStartY = null;
 let touchStartTime = null;
 let touchActive = false;
+// Cursor shapes and positions are in capture pixels, which the config message
+// relates to the video size
+let captureWidth = canvas.width;
+let captureHeight = canvas.height;
+let cursorX = -1;
+let cursorY = -1;
+let cursorHotX = 0;
+let cursorHotY = 0;
+let lastLocalInput = 0;
+// Video and audio messages start with a media header, see media-header.hpp
+const mediaHeaderVersion = 1;
+const mediaHeaderSize = 24;
+let streamId = -1;
+let lastVideoSequence = -1;
+// Frames delayed this much more than the recent best are dropped, milliseconds
+const staleFrameAge = 150;
+// Smallest arrival minus capture time seen lately: the offset between the
+// server and client clocks plus the base network delay
+let minTransitTime = Infinity;
+let minTransitTimeSetAt = 0;
+// Frames waiting for the decoder by PTS, and timings not yet reported to
+// the server, which turns them into per stage latency distributions
+let framesInDecoder = new Map();
+let frameReports = [];
+
+// Maps a pointer position to video pixels, the canvas may be displayed at a
+// different size than the stream
+function toVideoCoords(clientX, clientY) {
+    const rect = canvas.getBoundingClientRect();
+    return {
+        x: (clientX - rect.left) * canvas.width / rect.width,
+        y: (clientY - rect.top) * canvas.height / rect.height
+    };
+}
+
+// Places the cursor overlay over the video. It is hidden for a second after
+// local input, the user already sees where they touched.
+function updateCursor() {
+    const rect = canvas.getBoundingClientRect();
+    const isHidden = performance.now() - lastLocalInput < 1000 ||
+        cursorX < 0 || cursorY < 0 || cursorX >= captureWidth || cursorY >= captureHeight;
+    cursorCanvas.style.display = isHidden ? 'none' : 'block';
+    if (isHidden)
+        return;
+    const scaleX = rect.width / captureWidth;
+    const scaleY = rect.height / captureHeight;
+    cursorCanvas.style.left = `${rect.left + (cursorX - cursorHotX) * scaleX}px`;
+    cursorCanvas.style.top = `${rect.top + (cursorY - cursorHotY) * scaleY}px`;
+    cursorCanvas.style.width = `${cursorCanvas.width * scaleX}px`;
+    cursorCanvas.style.height = `${cursorCanvas.height * scaleY}px`;
+}
+
+function requestKeyframe() {
+    if (isWaitingForKeyframe)
+        return;
+    console.log('Requesting a keyframe');
+    isWaitingForKeyframe = true;
+    if (ws && ws.readyState === WebSocket.OPEN)
+        ws.send(JSON.stringify({ type: 'keyframe' }));
+}
+
+function parseMediaHeader(buffer) {
+    const view = new DataView(buffer.buffer, buffer.byteOffset, buffer.byteLength);
+    return {
+        version: view.getUint8(1),
+        flags: view.getUint8(2),
+        streamId: view.getUint8(3),
+        sequence: view.getUint32(4, true),
+        captureTime: Number(view.getBigInt64(8, true)),
+        pts: Number(view.getBigInt64(16, true))
+    };
+}
+
+// How much longer than the best recent frame this one took to arrive. The
+// baseline is renewed every 10 s so a clock adjustment cannot stick.
+function frameAge(captureTime) {
+    const now = performance.now();
+    const transitTime = performance.timeOrigin + now - captureTime / 1000;
+    if (transitTime < minTransitTime || now - minTransitTimeSetAt > 10000) {
+        minTransitTime = transitTime;
+        minTransitTimeSetAt = now;
+    }
+    return transitTime - minTransitTime;
+}
+
+// Wall clock in microseconds, the unit of the server's clock probes
+function nowUs() {
+    return Math.round((performance.timeOrigin + performance.now()) * 1000);
+}
+
+function reportFrame(sequence, receiveTime, decodeTime) {
+    requestAnimationFrame(() => {
+        frameReports.push({ sequence: sequence, receiveTime: receiveTime, decodeTime: decodeTime, presentTime: nowUs() });
+        if (frameReports.length >= 10 && ws && ws.readyState === WebSocket.OPEN) {
+            ws.send(JSON.stringify({ type: 'frames', frames: frameReports }));
+            frameReports = [];
+        }
+    });
+}
+
+// A new stream restarts timestamps and sequence numbers
+function startStream(header) {
+    console.log('Stream', header.streamId);
+    streamId = header.streamId;
+    lastVideoSequence = -1;
+    minTransitTime = Infinity;
+    framesInDecoder.clear();
+    if (window.audioNode)
+        window.audioNode.port.postMessage({ type: 'reset' });
+}
+
+// Resolves to the new decoder, or null if it could not be set up
+async function createVideoDecoder() {
+    const videoConfig = {
+        codec: videoCodec,
+        codedWidth: canvas.width,
+        codedHeight: canvas.height,
+        hardwareAcceleration: 'no-preference'
+    };
+
+    try {
+        const support = await VideoDecoder.isConfigSupported(videoConfig);
+        if (!support.supported) {
+            console.error('Configuration not supported:', support.config);
+            return null;
+        }
+    } catch (err) {
+        console.error('Error checking configuration:', err);
+        return null;
+    }
+    // The server switched codec or size while the check was running
+    if (videoConfig.codec !== videoCodec || videoConfig.codedWidth !== canvas.width ||
+        videoConfig.codedHeight !== canvas.height)
+        return null;
+
+    let decoder;
+    try {
+        decoder = new VideoDecoder({
+            output: frame => {
+                ctx.drawImage(frame, 0, 0, canvas.width, canvas.height);
+                const sent = framesInDecoder.get(frame.timestamp);
+                if (sent) {
+                    framesInDecoder.delete(frame.timestamp);
+                    reportFrame(sent.sequence, sent.receiveTime, nowUs());
+                }
+                // Lets the audio catch up with the picture
+                if (window.audioNode)
+                    window.audioNode.port.postMessage({
+                        type: 'sync',
+                        videoPts: frame.timestamp,
+                        outputLatency: audioContext.outputLatency || audioContext.baseLatency || 0
+                    });
+                frame.close();
+            },
+            error: err => {
+                console.error('Decoder error:', err);
+                // The decoder is closed now; start over from a keyframe
+                if (videoDecoder === decoder)
+                    videoDecoder = null;
+                requestKeyframe();
+            }
+        });
+        console.log('VideoDecoder created');
+    } catch (err) {
+        console.error('Error creating decoder:', err);
+        return null;
+    }
+    try {
+        decoder.configure(videoConfig);
+        console.log('VideoDecoder configured');
+    } catch (err) {
+        console.error('Error configuring decoder:', err);
+        decoder.close();
+        return null;
+    }
+    if (videoDecoder && videoDecoder.state !== 'closed')
+        videoDecoder.close();
+    videoDecoder = decoder;
+    return decoder;
+}
+
+function sendInput(message) {
+    lastLocalInput = performance.now();
+    updateCursor();
+    setTimeout(updateCursor, 1000);
+    ws.send(JSON.stringify(message));
+}
 
 // Handle start button for initial fullscreen and WebSocket setup
 startButton.addEventListener('click', async () => {
@@ -61,9 +258,7 @@ startButton.addEventListener('click', async () => {
             event.preventDefault();
             const touch = event.touches[0];
             touchActive = true;
-            const rect = canvas.getBoundingClientRect();
-            const x = touch.clientX - rect.left;
-            const y = touch.clientY - rect.top;
+            const { x, y } = toVideoCoords(touch.clientX, touch.clientY);
 
             touchStartX = x;
             touchStartY = y;
@@ -75,7 +270,7 @@ startButton.addEventListener('click', async () => {
                 x: x,
                 y: y
             };
-            ws.send(JSON.stringify(message));
+            sendInput(message);
         });
 
         canvas.addEventListener('pointermove', function(event) {
@@ -84,9 +279,7 @@ startButton.addEventListener('click', async () => {
                 return;
             if (touchActive)
             {
-                const rect = canvas.getBoundingClientRect();
-                const x = event.clientX - rect.left;
-                const y = event.clientY - rect.top;
+                const { x, y } = toVideoCoords(event.clientX, event.clientY);
 
                 const deltaTime = performance.now() - touchStartTime;
                 const deltaX = x - touchStartX;
@@ -99,21 +292,19 @@ startButton.addEventListener('click', async () => {
                         x: x,
                         y: y
                     };
-                    ws.send(JSON.stringify(message));
+                    sendInput(message);
                 }
             }
             else
             {
-                const rect = canvas.getBoundingClientRect();
-                const x = event.clientX - rect.left;
-                const y = event.clientY - rect.top;
+                const { x, y } = toVideoCoords(event.clientX, event.clientY);
 
                 const message = {
                     type: 'touchmove',
                     x: x,
                     y: y
                 };
-                ws.send(JSON.stringify(message));
+                sendInput(message);
             }
         });
 
@@ -121,9 +312,7 @@ startButton.addEventListener('click', async () => {
             event.preventDefault();
             touchActive = false;
             const touch = event.changedTouches[0];
-            const rect = canvas.getBoundingClientRect();
-            const x = touch.clientX - rect.left;
-            const y = touch.clientY - rect.top;
+            const { x, y } = toVideoCoords(touch.clientX, touch.clientY);
             const touchEndTime = performance.now();
 
             // Calculate time and movement differences
@@ -139,7 +328,7 @@ startButton.addEventListener('click', async () => {
                     x: touchStartX,
                     y: touchStartY
                 };
-                ws.send(JSON.stringify(message));
+                sendInput(message);
             } else {
                 // Send touchend event with current position
                 const message = {
@@ -147,7 +336,7 @@ startButton.addEventListener('click', async () => {
                     x: x,
                     y: y
                 };
-                ws.send(JSON.stringify(message));
+                sendInput(message);
             }
 
             // Reset touch start variables
@@ -162,7 +351,7 @@ startButton.addEventListener('click', async () => {
                 type: 'scroll',
                 deltaY: deltaY
             };
-            ws.send(JSON.stringify(message));
+            sendInput(message);
         });
     };
 
@@ -172,70 +361,84 @@ startButton.addEventListener('click', async () => {
 
         const messageType = buffer[0];
 
-        if (messageType === 0x01) {
-            const videoData = buffer.slice(1);
-
-            if (!videoDecoder) {
-                const videoConfig = {
-                    codec: 'avc1.42E01E',
-                    codedWidth: 1920,
-                    codedHeight: 1080,
-                    hardwareAcceleration: 'no-preference'
-                };
-
-                try {
-                    const support = await VideoDecoder.isConfigSupported(videoConfig);
-                    if (!support.supported) {
-                        console.error('Configuration not supported:', support.config);
-                        return;
-                    }
-                } catch (err) {
-                    console.error('Error checking configuration:', err);
-                    return;
-                }
+        let header = null;
+        if (messageType === 0x01 || messageType === 0x02) {
+            header = parseMediaHeader(buffer);
+            if (header.version !== mediaHeaderVersion) {
+                console.error('Unsupported media header version:', header.version);
+                return;
+            }
+            if (header.streamId !== streamId)
+                startStream(header);
+        }
 
-                try {
-                    videoDecoder = new VideoDecoder({
-                        output: frame => {
-                            ctx.drawImage(frame, 0, 0, canvas.width, canvas.height);
-                            frame.close();
-                        },
-                        error: err => {
-                            console.error('Decoder error:', err);
-                        }
-                    });
-                    console.log('VideoDecoder created');
-                } catch (err) {
-                    console.error('Error creating decoder:', err);
-                    return;
-                }
-                try {
-                    videoDecoder.configure(videoConfig);
-                    console.log('VideoDecoder configured');
-                } catch (err) {
-                    console.error('Error configuring decoder:', err);
-                    return;
+        if (messageType === 0x01) {
+            // Flags: 0x01 keyframe, 0x02 first and 0x04 last part of a frame
+            const flags = header.flags;
+            if (flags & 0x02) {
+                // A frame that never got its last part was dropped by the server
+                frameParts = [];
+                isFramePartKey = (flags & 0x01) !== 0;
+            } else if (frameParts.length === 0) {
+                return;
+            }
+            frameParts.push(buffer.subarray(mediaHeaderSize));
+            if (!(flags & 0x04))
+                return;
+            const isKeyframe = isFramePartKey;
+            let videoData = frameParts[0];
+            if (frameParts.length > 1) {
+                videoData = new Uint8Array(frameParts.reduce((size, part) => size + part.length, 0));
+                let offset = 0;
+                for (const part of frameParts) {
+                    videoData.set(part, offset);
+                    offset += part.length;
                 }
             }
-
-            // Parse NAL units to determine frame type
-            if (videoData.length < 5) {
-                console.error('Video data too short to determine frame type');
+            frameParts = [];
+            const receiveTime = nowUs();
+            // A gap means the server dropped frames this one refers to
+            const isSequenceGap = lastVideoSequence >= 0 && header.sequence !== lastVideoSequence + 1;
+            lastVideoSequence = header.sequence;
+            const age = frameAge(header.captureTime);
+            if (isKeyframe)
+                isWaitingForKeyframe = false;
+            else if (isWaitingForKeyframe)
+                return;
+            else if (isSequenceGap || age > staleFrameAge ||
+                     (videoDecoder && videoDecoder.decodeQueueSize > 2)) {
+                // Decoding a backlog only shows old pictures late; skip to a
+                // fresh keyframe instead
+                console.log('Dropping video frame', header.sequence, isSequenceGap ? 'after a gap' : `${Math.round(age)} ms late`);
+                requestKeyframe();
                 return;
             }
 
-            const type = videoData[4] & 0x1F;
-            const frameType = (type === 5) ? 'key' : 'delta';
+            if (!videoDecoder) {
+                if (!videoDecoderPending)
+                    videoDecoderPending = createVideoDecoder().finally(() => { videoDecoderPending = null; });
+                if (!await videoDecoderPending)
+                    return;
+            }
 
             const chunk = new EncodedVideoChunk({
-                type: frameType,
-                timestamp: performance.now(),
+                type: isKeyframe ? 'key' : 'delta',
+                timestamp: header.pts,
                 data: videoData
             });
 
-            videoDecoder.decode(chunk);
+            try {
+                // Frames the decoder drops are never reported
+                if (framesInDecoder.size > 100)
+                    framesInDecoder.clear();
+                framesInDecoder.set(header.pts, { sequence: header.sequence, receiveTime: receiveTime });
+                videoDecoder.decode(chunk);
+            } catch (err) {
+                console.error('Error decoding video chunk:', err);
+                requestKeyframe();
+            }
         } else if (messageType === 0x02) {
-            const opusData = buffer.slice(1);
+            const opusData = buffer.slice(mediaHeaderSize);
 
             if (!audioDecoder){
                 const audioConfig = {
@@ -257,6 +460,7 @@ startButton.addEventListener('click', async () => {
                     audioDecoder = new AudioDecoder({
                         output: (audioData) => {
                             // Create a Float32Array to hold the audio samples
+                            const pts = audioData.timestamp;
                             const numChannels = audioData.numberOfChannels;
                             const numFrames = audioData.numberOfFrames;
                             const format = audioData.format; // Should be 'f32' (float32)
@@ -273,7 +477,8 @@ startButton.addEventListener('click', async () => {
 
                             // Send the extracted data to the AudioWorkletNode
                             if (window.audioNode && window.audioNode.port) {
-                                window.audioNode.port.postMessage(audioBuffer.buffer, [audioBuffer.buffer]); // Transfer the ArrayBuffer
+                                window.audioNode.port.postMessage({ type: 'samples', pts: pts, samples: audioBuffer.buffer },
+                                                                  [audioBuffer.buffer]); // Transfer the ArrayBuffer
                             }
                         },
                         error: (err) => {
@@ -291,7 +496,7 @@ startButton.addEventListener('click', async () => {
                 try {
                     const chunk = new EncodedAudioChunk({
                         type: 'key', // All Opus packets are treated as key frames
-                        timestamp: performance.now(),
+                        timestamp: header.pts,
                         data: opusData,
                     });
 
@@ -300,6 +505,72 @@ startButton.addEventListener('click', async () => {
                     console.error('Error decoding audio chunk:', err);
                 }
             }
+        } else if (messageType === 0x03) {
+            const message = JSON.parse(new TextDecoder().decode(buffer.subarray(1)));
+            if (message.type === 'clock') {
+                ws.send(JSON.stringify({ type: 'clock', serverTime: message.serverTime, clientTime: nowUs() }));
+                return;
+            }
+            if (message.type === 'codec') {
+                console.log('Video codec:', message.name, message.codec);
+                videoCodec = message.codec;
+                if (videoDecoder) {
+                    videoDecoder.close();
+                    videoDecoder = null;
+                }
+                return;
+            }
+            const config = message;
+            if (config.width !== canvas.width || config.height !== canvas.height) {
+                console.log('Stream size:', config.width, 'x', config.height);
+                canvas.width = config.width;
+                canvas.height = config.height;
+                canvas.style.width = `${config.width}px`;
+                canvas.style.height = `${config.height}px`;
+                if (videoDecoder) {
+                    videoDecoder.close();
+                    videoDecoder = null;
+                }
+            }
+            captureWidth = config.captureWidth;
+            captureHeight = config.captureHeight;
+            updateCursor();
+
+            // Codec negotiation: report what this browser can decode, the
+            // server picks one of them and starts the stream
+            const supported = [];
+            for (const codec of config.codecs) {
+                try {
+                    const support = await VideoDecoder.isConfigSupported({
+                        codec: codec.codec,
+                        codedWidth: config.width,
+                        codedHeight: config.height,
+                        hardwareAcceleration: 'no-preference'
+                    });
+                    if (support.supported)
+                        supported.push(codec.name);
+                } catch (err) {
+                    console.error('Error checking codec', codec.name, err);
+                }
+            }
+            console.log('Supported codecs:', supported);
+            ws.send(JSON.stringify({ type: 'codecs', codecs: supported }));
+        } else if (messageType === 0x04) {
+            const view = new DataView(data);
+            const width = view.getUint16(1, true);
+            const height = view.getUint16(3, true);
+            cursorHotX = view.getUint16(5, true);
+            cursorHotY = view.getUint16(7, true);
+            cursorCanvas.width = width;
+            cursorCanvas.height = height;
+            if (width > 0 && height > 0)
+                cursorCtx.putImageData(new ImageData(new Uint8ClampedArray(data, 9, width * height * 4), width, height), 0, 0);
+            updateCursor();
+        } else if (messageType === 0x05) {
+            const view = new DataView(data);
+            cursorX = view.getInt16(1, true);
+            cursorY = view.getInt16(3, true);
+            updateCursor();
         } else {
             console.error('Unknown message type:', messageType);
         }
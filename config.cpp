@@ -0,0 +1,280 @@
+#include "config.hpp"
+#include "video-encoder.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <log/log.hpp>
+#include <sstream>
+#include <unordered_map>
+
+auto config() -> Config &
+{
+  static auto inst = Config{};
+  return inst;
+}
+
+namespace
+{
+  auto parseOnOff(const std::string &name, const std::string &v) -> bool
+  {
+    if (v != "on" && v != "off")
+    {
+      LOG("Expected on or off for", name, "got", v);
+      exit(1);
+    }
+    return v == "on";
+  }
+
+  auto parseCrf(const std::string &v) -> int
+  {
+    const auto crf = std::stoi(v);
+    if (crf < 0 || crf > 51)
+    {
+      LOG("CRF must be between 0 and 51, got", v);
+      exit(1);
+    }
+    return crf;
+  }
+
+  auto parseFps(const std::string &name, const std::string &v) -> int
+  {
+    const auto fps = std::stoi(v);
+    if (fps < 1 || fps > 240)
+    {
+      LOG(name, "must be between 1 and 240, got", v);
+      exit(1);
+    }
+    return fps;
+  }
+} // namespace
+
+auto Config::parse(int argc, char **argv) -> void
+{
+  const auto options = std::unordered_map<std::string, std::function<void(const std::string &)>>{
+    {"capture",
+     [this](const std::string &v) {
+       if (v != "shm" && v != "gl" && v != "synthetic" && v != "file")
+       {
+         LOG("Unknown capture source:", v);
+         exit(1);
+       }
+       capture = v;
+     }},
+    {"capture-pattern",
+     [this](const std::string &v) {
+       if (v != "static" && v != "scroll" && v != "noise")
+       {
+         LOG("Expected static, scroll or noise for capture-pattern, got", v);
+         exit(1);
+       }
+       capturePattern = v;
+     }},
+    {"capture-file", [this](const std::string &v) { captureFile = v; }},
+    {"capture-rect",
+     [this](const std::string &v) {
+       // X geometry: WIDTHxHEIGHT+X+Y, e.g. 1280x720+100+50
+       auto c = char{};
+       auto ss = std::istringstream{v};
+       if (!(ss >> captureWidth >> c) || c != 'x' || !(ss >> captureHeight >> c) || c != '+' ||
+           !(ss >> captureX >> c) || c != '+' || !(ss >> captureY) || !ss.eof())
+       {
+         LOG("Expected WIDTHxHEIGHT+X+Y for capture-rect, got", v);
+         exit(1);
+       }
+     }},
+    {"output-size",
+     [this](const std::string &v) {
+       auto c = char{};
+       auto ss = std::istringstream{v};
+       if (!(ss >> width >> c) || c != 'x' || !(ss >> height) || !ss.eof())
+       {
+         LOG("Expected WIDTHxHEIGHT for output-size, got", v);
+         exit(1);
+       }
+     }},
+    {"broadcast", [this](const std::string &v) { broadcast = parseOnOff("broadcast", v); }},
+    {"codecs",
+     [this](const std::string &v) {
+       codecs.clear();
+       auto ss = std::istringstream{v};
+       for (auto item = std::string{}; std::getline(ss, item, ',');)
+       {
+         if (!VideoEncoder::find(item))
+         {
+           LOG("Unknown codec:", item);
+           exit(1);
+         }
+         codecs.push_back(item);
+       }
+     }},
+    {"video-bitrate", [this](const std::string &v) { videoBitrate = std::stoi(v); }},
+    {"intra-refresh", [this](const std::string &v) { intraRefresh = parseOnOff("intra-refresh", v); }},
+    {"slice-size", [this](const std::string &v) { sliceSize = std::stoi(v); }},
+    {"crf", [this](const std::string &v) { crf = parseCrf(v); }},
+    {"crf-min", [this](const std::string &v) { crfMin = parseCrf(v); }},
+    {"crf-max", [this](const std::string &v) { crfMax = parseCrf(v); }},
+    {"adaptive-rate", [this](const std::string &v) { adaptiveRate = parseOnOff("adaptive-rate", v); }},
+    {"fps", [this](const std::string &v) { fps = parseFps("fps", v); }},
+    {"idle-fps", [this](const std::string &v) { idleFps = parseFps("idle-fps", v); }},
+    {"pacing-spin", [this](const std::string &v) { pacingSpin = std::stoi(v); }},
+    {"audio-frame",
+     [this](const std::string &v) {
+       // Milliseconds; Opus only has these frame sizes below 40 ms
+       const auto sizes = std::unordered_map<std::string, int>{{"2.5", 120}, {"5", 240}, {"10", 480}, {"20", 960}};
+       const auto it = sizes.find(v);
+       if (it == std::end(sizes))
+       {
+         LOG("Expected 2.5, 5, 10 or 20 for audio-frame, got", v);
+         exit(1);
+       }
+       audioFrame = it->second;
+     }},
+    {"audio-bitrate", [this](const std::string &v) { audioBitrate = std::stoi(v); }},
+    {"audio-dtx", [this](const std::string &v) { audioDtx = parseOnOff("audio-dtx", v); }},
+    {"audio-fec", [this](const std::string &v) { audioFec = parseOnOff("audio-fec", v); }},
+    {"rgb2yuv-kernel",
+     [this](const std::string &v) {
+       const auto kernel = Rgb2Yuv::parseKernel(v);
+       if (!kernel)
+       {
+         LOG("Unknown color conversion kernel:", v);
+         exit(1);
+       }
+       if (!Rgb2Yuv::isSupported(*kernel))
+       {
+         LOG("Color conversion kernel is not supported by this CPU:", v);
+         exit(1);
+       }
+       rgb2yuvKernel = *kernel;
+     }},
+    {"trace", [this](const std::string &v) { trace = parseOnOff("trace", v); }},
+    {"bench", [this](const std::string &v) { bench = std::stoi(v); }},
+    {"conv-threads", [this](const std::string &v) { convThreads = std::stoi(v); }},
+    {"conv-affinity",
+     [this](const std::string &v) {
+       // Comma separated CPUs and ranges, e.g. 0-3,6
+       convAffinity.clear();
+       auto ss = std::istringstream{v};
+       for (auto item = std::string{}; std::getline(ss, item, ',');)
+       {
+         const auto dash = item.find('-');
+         const auto first = std::stoi(item.substr(0, dash));
+         const auto last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+         for (auto cpu = first; cpu <= last; ++cpu)
+           convAffinity.push_back(cpu);
+       }
+     }},
+    {"io-threads", [this](const std::string &v) { ioThreads = std::stoi(v); }},
+  };
+
+  const auto environment = std::unordered_map<std::string, std::string>{
+    {"SCREEN_CAST_ADAPTIVE_RATE", "adaptive-rate"},
+    {"SCREEN_CAST_BROADCAST", "broadcast"},
+    {"SCREEN_CAST_CODECS", "codecs"},
+    {"SCREEN_CAST_INTRA_REFRESH", "intra-refresh"},
+    {"SCREEN_CAST_SLICE_SIZE", "slice-size"},
+    {"SCREEN_CAST_FPS", "fps"},
+    {"SCREEN_CAST_AUDIO_FRAME", "audio-frame"},
+    {"SCREEN_CAST_AUDIO_DTX", "audio-dtx"},
+    {"SCREEN_CAST_AUDIO_FEC", "audio-fec"},
+    {"SCREEN_CAST_RGB2YUV_KERNEL", "rgb2yuv-kernel"},
+    {"SCREEN_CAST_TRACE", "trace"},
+    {"SCREEN_CAST_CONV_THREADS", "conv-threads"},
+    {"SCREEN_CAST_CONV_AFFINITY", "conv-affinity"},
+    {"SCREEN_CAST_IO_THREADS", "io-threads"},
+  };
+  for (const auto &[var, name] : environment)
+    if (const auto v = getenv(var.c_str()))
+      try
+      {
+        options.at(name)(v);
+      }
+      catch (const std::exception &e)
+      {
+        LOG("Invalid value for", var, e.what());
+        exit(1);
+      }
+
+  for (auto i = 1; i < argc; ++i)
+  {
+    const auto arg = std::string{argv[i]};
+    const auto eq = arg.find('=');
+    if (!arg.starts_with("--") || eq == std::string::npos)
+    {
+      LOG("Expected --option=value, got", arg);
+      exit(1);
+    }
+    const auto name = arg.substr(2, eq - 2);
+    const auto it = options.find(name);
+    if (it == std::end(options))
+    {
+      LOG("Unknown option:", name);
+      exit(1);
+    }
+    try
+    {
+      it->second(arg.substr(eq + 1));
+    }
+    catch (const std::exception &e)
+    {
+      LOG("Invalid value for", name, e.what());
+      exit(1);
+    }
+  }
+
+  if (capture == "file" && captureFile.empty())
+  {
+    LOG("File capture needs --capture-file");
+    exit(1);
+  }
+
+  if (!adaptiveRate)
+    return;
+  if (crfMin > crfMax)
+  {
+    LOG("crf-min", crfMin, "is above crf-max", crfMax);
+    exit(1);
+  }
+  crf = std::clamp(crf, crfMin, crfMax);
+}
+
+auto Config::fitToScreen(int screenWidth, int screenHeight) -> void
+{
+  if (captureWidth == 0)
+    captureWidth = screenWidth - captureX;
+  if (captureHeight == 0)
+    captureHeight = screenHeight - captureY;
+  if (captureX < 0 || captureY < 0 || captureWidth <= 0 || captureHeight <= 0 ||
+      captureX + captureWidth > screenWidth || captureY + captureHeight > screenHeight)
+  {
+    LOG("Capture rectangle",
+        captureWidth,
+        "x",
+        captureHeight,
+        "+",
+        captureX,
+        "+",
+        captureY,
+        "is outside of the",
+        screenWidth,
+        "x",
+        screenHeight,
+        "screen");
+    exit(1);
+  }
+
+  if (width == 0 || height == 0)
+  {
+    // 4:2:0 needs an even size; drop the odd column or row of the capture too
+    // so the picture is not scaled by one pixel
+    captureWidth &= ~1;
+    captureHeight &= ~1;
+    width = captureWidth;
+    height = captureHeight;
+  }
+  if (width % 2 != 0 || height % 2 != 0 || width > captureWidth || height > captureHeight)
+  {
+    LOG("Output size", width, "x", height, "must be even and not larger than the capture area");
+    exit(1);
+  }
+}
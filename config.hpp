@@ -0,0 +1,47 @@
+#pragma once
+#include "rgb2yuv.hpp"
+#include <string>
+#include <vector>
+
+struct Config
+{
+  std::string capture = "shm"; // shm or gl grab the screen, synthetic and file are headless
+  std::string capturePattern = "scroll"; // synthetic capture: static, scroll or noise
+  std::string captureFile;               // file capture: Y4M or raw BGRX recording
+  int captureX = 0;
+  int captureY = 0;
+  int captureWidth = 0;  // 0 captures to the right edge of the screen
+  int captureHeight = 0; // 0 captures to the bottom edge of the screen
+  int width = 0;         // encoded size, 0 keeps the capture size
+  int height = 0;
+  bool broadcast = false;       // all sessions share one capture and encode pipeline
+  std::vector<std::string> codecs; // video encoder backends offered to clients, empty for all
+  int videoBitrate = 0;            // kbit/s the negotiated codec should fit in, 0 picks the cheapest
+  bool intraRefresh = false;       // x264 refreshes intra columns every period instead of sending IDR frames
+  int sliceSize = 0;               // bytes per x264 slice, each sent as soon as it is encoded; 0 sends whole frames
+  int crf = 34;                 // CRF to start with, on the x264 scale
+  int crfMin = 23;              // best quality the rate controller may pick
+  int crfMax = 45;              // worst quality before it lowers the frame rate
+  bool adaptiveRate = true;     // retune CRF and frame rate from send queue depth and RTT
+  int fps = 60;                 // capture rate, ideally the headset's refresh rate
+  int idleFps = 10;             // rate damage is polled at after half a second without changes
+  int pacingSpin = 0;           // microseconds spun before each frame deadline instead of sleeping
+  int audioFrame = 480;         // Opus frame in samples per channel at 48 kHz: 120, 240, 480 or 960 (2.5 to 20 ms)
+  int audioBitrate = 128;       // Opus bitrate in kbit/s
+  bool audioDtx = true;         // Opus sends next to nothing during silence
+  bool audioFec = false;        // Opus carries a low bitrate copy of the previous frame for loss recovery
+  Rgb2Yuv::Kernel rgb2yuvKernel = Rgb2Yuv::detectKernel();
+  bool trace = false;            // records pipeline spans, served as a Chrome trace at /trace
+  int bench = 0;                 // seconds to run the video pipeline unpaced without a server, 0 serves clients
+  int convThreads = -1;          // color conversion pool size, -1 picks one from the core count
+  std::vector<int> convAffinity; // CPUs the color conversion threads are pinned to, empty for any
+  int ioThreads = -1;            // threads serving HTTP and WebSocket I/O, -1 picks one from the core count
+
+  // Options are --name=value; some of them can also be preset from the environment
+  auto parse(int argc, char **argv) -> void;
+  // Resolves the defaults of the capture rectangle and output size against the
+  // screen and validates them
+  auto fitToScreen(int screenWidth, int screenHeight) -> void;
+};
+
+auto config() -> Config &;
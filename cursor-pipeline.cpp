@@ -0,0 +1,132 @@
+#include "cursor-pipeline.hpp"
+#include <X11/extensions/Xfixes.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <log/log.hpp>
+
+namespace
+{
+  // 125 Hz, faster than the video so the cursor leads the picture
+  constexpr auto PollInterval = std::chrono::milliseconds{8};
+
+  auto putU16(uint8_t *dst, int v) -> void
+  {
+    dst[0] = v & 0xff;
+    dst[1] = (v >> 8) & 0xff;
+  }
+} // namespace
+
+CursorPipeline::CursorPipeline(int x, int y, StreamMetrics &metrics, OnMessage onShape, OnMessage onPosition)
+  : x(x), y(y), onShape(std::move(onShape)), onPosition(std::move(onPosition)), metrics(metrics)
+{
+  cursorThread = std::thread{[this]() { cursorThreadFunc(); }};
+}
+
+CursorPipeline::~CursorPipeline()
+{
+  isRunning = false;
+  cursorThread.join();
+}
+
+auto CursorPipeline::cursorThreadFunc() -> void
+{
+  const auto display = XOpenDisplay(nullptr);
+  if (!display)
+  {
+    LOG("Cannot open display");
+    return;
+  }
+
+  auto eventBase = 0;
+  auto errorBase = 0;
+  if (!XFixesQueryExtension(display, &eventBase, &errorBase))
+  {
+    LOG("XFixes extension is not supported, the cursor is not sent");
+    XCloseDisplay(display);
+    return;
+  }
+  const auto root = DefaultRootWindow(display);
+  XFixesSelectCursorInput(display, root, XFixesDisplayCursorNotifyMask);
+
+  auto serial = sendShape(display);
+  auto lastX = INT_MIN;
+  auto lastY = INT_MIN;
+  auto target = std::chrono::steady_clock::now();
+  while (isRunning)
+  {
+    const auto pollStart = std::chrono::steady_clock::now();
+    auto isShapeChanged = false;
+    while (XPending(display) > 0)
+    {
+      auto event = XEvent{};
+      XNextEvent(display, &event);
+      if (event.type == eventBase + XFixesCursorNotify &&
+          reinterpret_cast<XFixesCursorNotifyEvent &>(event).cursor_serial != serial)
+        isShapeChanged = true;
+    }
+    if (isShapeChanged)
+      serial = sendShape(display);
+
+    auto rootRet = Window{};
+    auto childRet = Window{};
+    auto rootX = 0;
+    auto rootY = 0;
+    auto winX = 0;
+    auto winY = 0;
+    auto mask = 0u;
+    if (XQueryPointer(display, root, &rootRet, &childRet, &rootX, &rootY, &winX, &winY, &mask) &&
+        (rootX != lastX || rootY != lastY))
+    {
+      lastX = rootX;
+      lastY = rootY;
+      auto message = Message::acquire();
+      message->setType(0x05); // Cursor position identifier
+      const auto data = message->inlineData();
+      putU16(data, std::clamp(rootX - x, SHRT_MIN, SHRT_MAX));
+      putU16(data + 2, std::clamp(rootY - y, SHRT_MIN, SHRT_MAX));
+      message->setInlineSize(4);
+      onPosition(std::move(message));
+    }
+    metrics.cursor.record(
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - pollStart).count());
+
+    target += PollInterval;
+    std::this_thread::sleep_until(target);
+  }
+
+  XCloseDisplay(display);
+  LOG("Cursor thread ended");
+}
+
+auto CursorPipeline::sendShape(Display *display) -> unsigned long
+{
+  const auto image = XFixesGetCursorImage(display);
+  if (!image)
+    return 0;
+
+  auto message = Message::acquire();
+  message->setType(0x04); // Cursor shape identifier
+  const auto data = message->allocPayload(8 + image->width * image->height * 4);
+  putU16(data, image->width);
+  putU16(data + 2, image->height);
+  putU16(data + 4, image->xhot);
+  putU16(data + 6, image->yhot);
+  // XFixes gives premultiplied ARGB in the low 32 bits of a long, canvas
+  // ImageData wants straight RGBA
+  auto dst = data + 8;
+  for (auto i = 0; i < image->width * image->height; ++i, dst += 4)
+  {
+    const auto pixel = static_cast<uint32_t>(image->pixels[i]);
+    const auto a = static_cast<int>(pixel >> 24);
+    const auto unpremultiply = [a](int c) { return a == 0 ? 0 : std::min(255, (c * 255 + a / 2) / a); };
+    dst[0] = unpremultiply((pixel >> 16) & 0xff);
+    dst[1] = unpremultiply((pixel >> 8) & 0xff);
+    dst[2] = unpremultiply(pixel & 0xff);
+    dst[3] = a;
+  }
+  const auto serial = image->cursor_serial;
+  XFree(image);
+  onShape(std::move(message));
+  return serial;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "message.hpp"
+#include "metrics.hpp"
+#include <X11/Xlib.h>
+#include <atomic>
+#include <functional>
+#include <thread>
+
+// Tracks the X cursor on its own thread and display connection. The shape is
+// fetched only when XFixes reports a new cursor, the position is polled at a
+// high rate and reported when it moves. Clients draw the cursor as an overlay,
+// so pointer motion costs a few bytes instead of re-encoded macroblocks.
+class CursorPipeline
+{
+public:
+  // Called on the cursor thread with a complete message, header included.
+  // Shape: 0x04, width, height, xhot, yhot as little-endian uint16, then
+  // width * height RGBA pixels. Position: 0x05, x, y of the hot spot as
+  // little-endian int16, relative to the capture area in capture pixels.
+  using OnMessage = std::function<void(MessageRef message)>;
+
+  CursorPipeline(int x, int y, StreamMetrics &metrics, OnMessage onShape, OnMessage onPosition);
+  ~CursorPipeline();
+
+private:
+  auto cursorThreadFunc() -> void;
+  // Returns the serial of the cursor it sent
+  auto sendShape(Display *display) -> unsigned long;
+
+  const int x;
+  const int y;
+  OnMessage onShape;
+  OnMessage onPosition;
+  StreamMetrics &metrics;
+  std::atomic<bool> isRunning = true;
+  std::thread cursorThread;
+};
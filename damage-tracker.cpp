@@ -0,0 +1,63 @@
+#include "damage-tracker.hpp"
+#include <algorithm>
+#include <log/log.hpp>
+
+DamageTracker::DamageTracker(Display *display, int x, int y, int width, int height)
+  : display(display), x(x), y(y), width(width), height(height)
+{
+  auto errorBase = 0;
+  if (!XDamageQueryExtension(display, &eventBase, &errorBase))
+  {
+    LOG("XDamage extension is not supported, capturing every frame");
+    return;
+  }
+
+  // Report only the empty -> non-empty transition; the damage is reset by
+  // XDamageSubtract in poll(), which re-arms the notification.
+  damage = XDamageCreate(display, DefaultRootWindow(display), XDamageReportNonEmpty);
+  const auto screen = DefaultScreen(display);
+  if (x > 0 || y > 0 || x + width < DisplayWidth(display, screen) || y + height < DisplayHeight(display, screen))
+    region = XFixesCreateRegion(display, nullptr, 0);
+}
+
+DamageTracker::~DamageTracker()
+{
+  if (region != None)
+    XFixesDestroyRegion(display, region);
+  if (damage != None)
+    XDamageDestroy(display, damage);
+}
+
+auto DamageTracker::poll() -> bool
+{
+  if (damage == None)
+    return true;
+
+  auto isNotified = false;
+  while (XPending(display) > 0)
+  {
+    auto event = XEvent{};
+    XNextEvent(display, &event);
+    if (event.type == eventBase + XDamageNotify)
+      isNotified = true;
+  }
+  if (!isNotified)
+    return false;
+
+  // Any damage of the whole screen is a change, no need to ask where it is
+  if (region == None)
+  {
+    XDamageSubtract(display, damage, None, None);
+    return true;
+  }
+
+  XDamageSubtract(display, damage, None, region);
+  auto n = 0;
+  const auto damaged = XFixesFetchRegion(display, region, &n);
+  const auto isInside = std::any_of(damaged, damaged + n, [&](const XRectangle &r) {
+    return r.x < x + width && r.x + r.width > x && r.y < y + height && r.y + r.height > y;
+  });
+  if (damaged)
+    XFree(damaged);
+  return isInside;
+}
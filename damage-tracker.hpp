@@ -0,0 +1,29 @@
+#pragma once
+#include <X11/Xlib.h>
+#include <X11/extensions/Xdamage.h>
+
+// Watches the root window with XDamage and reports whether the capture area
+// changed since the previous poll. If the extension is missing every poll
+// reports the whole area as dirty.
+class DamageTracker
+{
+public:
+  DamageTracker(Display *display, int x, int y, int width, int height);
+  ~DamageTracker();
+
+  // Drains pending damage events. Returns true if anything inside the capture
+  // area changed.
+  auto poll() -> bool;
+
+private:
+  Display *display;
+  int x;
+  int y;
+  int width;
+  int height;
+  int eventBase = 0;
+  Damage damage = None;
+  // Only set when the capture area is part of the screen; the damaged region
+  // is then fetched to tell whether it touches the area
+  XserverRegion region = None;
+};
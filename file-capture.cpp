@@ -0,0 +1,159 @@
+#include "file-capture.hpp"
+#include "config.hpp"
+#include <algorithm>
+#include <fstream>
+#include <log/log.hpp>
+#include <sstream>
+
+namespace
+{
+  // Recordings beyond this are cut short, 1080p BGRX is about 8 MB a frame
+  constexpr auto MaxBytes = size_t{512} << 20;
+
+  struct Y4mHeader
+  {
+    int width = 0;
+    int height = 0;
+    bool is444 = false;
+  };
+
+  // Reads the stream header line; nullopt if the file is not Y4M, in which
+  // case nothing was consumed
+  auto readY4mHeader(std::istream &f, const std::string &path) -> std::optional<Y4mHeader>
+  {
+    auto magic = std::string(9, '\0');
+    if (!f.read(magic.data(), magic.size()) || magic != "YUV4MPEG2")
+    {
+      f.clear();
+      f.seekg(0);
+      return std::nullopt;
+    }
+
+    auto line = std::string{};
+    std::getline(f, line);
+    auto header = Y4mHeader{};
+    auto ss = std::istringstream{line};
+    for (auto token = std::string{}; ss >> token;)
+    {
+      if (token[0] == 'W')
+        header.width = std::stoi(token.substr(1));
+      else if (token[0] == 'H')
+        header.height = std::stoi(token.substr(1));
+      else if (token[0] == 'C')
+      {
+        // 4:2:0 in any chroma siting, the default without a C tag, or 4:4:4
+        header.is444 = token == "C444";
+        if (!header.is444 && !token.starts_with("C420"))
+        {
+          LOG(path, "has chroma subsampling", token.substr(1), "only 420 and 444 can be replayed");
+          exit(1);
+        }
+      }
+    }
+    if (header.width < 2 || header.height < 2)
+    {
+      LOG(path, "has no frame size in its Y4M header");
+      exit(1);
+    }
+    return header;
+  }
+
+  // BT.601 studio range, the inverse of what the color converter does
+  auto yuvToBgrx(int y, int u, int v, uint8_t *px) -> void
+  {
+    const auto c = 298 * (y - 16) + 128;
+    const auto d = u - 128;
+    const auto e = v - 128;
+    px[0] = static_cast<uint8_t>(std::clamp((c + 516 * d) >> 8, 0, 255));
+    px[1] = static_cast<uint8_t>(std::clamp((c - 100 * d - 208 * e) >> 8, 0, 255));
+    px[2] = static_cast<uint8_t>(std::clamp((c + 409 * e) >> 8, 0, 255));
+    px[3] = 0xff;
+  }
+} // namespace
+
+auto FileCapture::probe(const std::string &path) -> std::pair<int, int>
+{
+  auto f = std::ifstream{path, std::ios::binary};
+  if (!f)
+  {
+    LOG("Cannot open", path);
+    exit(1);
+  }
+  if (const auto header = readY4mHeader(f, path))
+    return {header->width, header->height};
+
+  if (config().captureWidth <= 0 || config().captureHeight <= 0)
+  {
+    LOG(path, "is not Y4M; replaying raw BGRX needs --capture-rect to give the frame size");
+    exit(1);
+  }
+  return {config().captureX + config().captureWidth, config().captureY + config().captureHeight};
+}
+
+auto FileCapture::create(const std::string &path, int x, int y, int width, int height)
+  -> std::unique_ptr<FileCapture>
+{
+  const auto [fileWidth, fileHeight] = probe(path);
+  auto f = std::ifstream{path, std::ios::binary};
+  const auto header = readY4mHeader(f, path);
+
+  auto capture = std::unique_ptr<FileCapture>{new FileCapture{fileWidth, x, y}};
+  const auto frameBytes = size_t{4} * fileWidth * fileHeight;
+  const auto chromaWidth = header && !header->is444 ? (fileWidth + 1) / 2 : fileWidth;
+  const auto chromaHeight = header && !header->is444 ? (fileHeight + 1) / 2 : fileHeight;
+  auto planes = std::vector<uint8_t>(fileWidth * fileHeight + 2 * chromaWidth * chromaHeight);
+  while ((capture->frames.size() + 1) * frameBytes <= MaxBytes)
+  {
+    auto frame = std::vector<uint8_t>(frameBytes);
+    if (!header)
+    {
+      if (!f.read(reinterpret_cast<char *>(frame.data()), frame.size()))
+        break;
+      capture->frames.push_back(std::move(frame));
+      continue;
+    }
+
+    auto line = std::string{};
+    if (!std::getline(f, line) || !line.starts_with("FRAME") ||
+        !f.read(reinterpret_cast<char *>(planes.data()), planes.size()))
+      break;
+    const auto lumaPlane = planes.data();
+    const auto uPlane = lumaPlane + fileWidth * fileHeight;
+    const auto vPlane = uPlane + chromaWidth * chromaHeight;
+    for (auto row = 0; row < fileHeight; ++row)
+      for (auto col = 0; col < fileWidth; ++col)
+      {
+        const auto chroma = header->is444 ? row * chromaWidth + col : row / 2 * chromaWidth + col / 2;
+        yuvToBgrx(
+          lumaPlane[row * fileWidth + col], uPlane[chroma], vPlane[chroma], &frame[(row * fileWidth + col) * 4]);
+      }
+    capture->frames.push_back(std::move(frame));
+  }
+
+  if (capture->frames.empty())
+  {
+    LOG(path, "has no complete", fileWidth, "x", fileHeight, "frame");
+    return nullptr;
+  }
+  LOG("Replaying",
+      capture->frames.size(),
+      "frames of",
+      path,
+      "capture area",
+      width,
+      "x",
+      height,
+      "+",
+      x,
+      "+",
+      y);
+  return capture;
+}
+
+FileCapture::FileCapture(int fileWidth, int x, int y) : lineSize(fileWidth * 4), offset(y * lineSize + x * 4) {}
+
+auto FileCapture::grab(int) -> std::optional<Frame>
+{
+  auto &frame = frames[next++ % frames.size()];
+  return Frame{frame.data() + offset, lineSize, Rgb2Yuv::Format::Bgrx32, Rgb2Yuv::RowOrder::TopDown};
+}
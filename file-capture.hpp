@@ -0,0 +1,28 @@
+#pragma once
+#include "capture.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Headless source that replays a recording in a loop. Y4M files (4:2:0 or
+// 4:4:4) are converted to BGRX with BT.601 on load; any other file is taken
+// as raw BGRX frames the size of the screen given by --capture-rect. Frames
+// are read into memory up front, up to a limit, so replay does not measure
+// the disk.
+class FileCapture final : public Capture
+{
+public:
+  // Frame size of the recording; exits on a file it cannot read
+  static auto probe(const std::string &path) -> std::pair<int, int>;
+  static auto create(const std::string &path, int x, int y, int width, int height)
+    -> std::unique_ptr<FileCapture>;
+  auto grab(int buffer) -> std::optional<Frame> final;
+
+private:
+  FileCapture(int fileWidth, int x, int y);
+
+  const int lineSize;
+  const int offset; // of the capture rectangle in a frame
+  std::vector<std::vector<uint8_t>> frames;
+  size_t next = 0;
+};
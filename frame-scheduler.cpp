@@ -0,0 +1,73 @@
+#include "frame-scheduler.hpp"
+#include <cerrno>
+#include <poll.h>
+#include <time.h>
+
+namespace
+{
+  auto toTimespec(std::chrono::nanoseconds ns) -> timespec
+  {
+    return timespec{.tv_sec = static_cast<time_t>(ns.count() / 1'000'000'000),
+                    .tv_nsec = static_cast<long>(ns.count() % 1'000'000'000)};
+  }
+} // namespace
+
+FrameScheduler::FrameScheduler(int fps, int idleFps, std::chrono::microseconds spin)
+  : fps(fps), idleFps(idleFps), spin(spin), origin(Clock::now())
+{
+}
+
+auto FrameScheduler::setFps(int value) -> void
+{
+  if (value == fps)
+    return;
+  origin = deadline(frame);
+  frame = 0;
+  fps = value;
+}
+
+auto FrameScheduler::wait() -> int
+{
+  ++frame;
+  auto missed = 0;
+  if (const auto now = Clock::now(); now > deadline(frame))
+  {
+    // Skip to the first deadline still ahead, keeping the grid's phase
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - origin).count();
+    const auto next = elapsed * fps / 1'000'000'000 + 1;
+    missed = static_cast<int>(next - frame);
+    frame = next;
+  }
+  sleepUntil(deadline(frame));
+  return missed;
+}
+
+auto FrameScheduler::waitIdle(int fd) -> void
+{
+  auto pfd = pollfd{.fd = fd, .events = POLLIN, .revents = 0};
+  const auto timeout = toTimespec(std::chrono::nanoseconds{1'000'000'000 / idleFps});
+  while (ppoll(&pfd, fd >= 0 ? 1 : 0, &timeout, nullptr) < 0 && errno == EINTR)
+    ;
+  // The frame after an idle period is grabbed right away
+  origin = Clock::now();
+  frame = 0;
+}
+
+auto FrameScheduler::deadline(int64_t n) const -> Clock::time_point
+{
+  return origin + std::chrono::nanoseconds{n * 1'000'000'000 / fps};
+}
+
+auto FrameScheduler::sleepUntil(Clock::time_point t) const -> void
+{
+  // steady_clock is CLOCK_MONOTONIC, so its time points are absolute
+  // deadlines for clock_nanosleep
+  if (const auto sleepTarget = t - spin; sleepTarget > Clock::now())
+  {
+    const auto ts = toTimespec(sleepTarget.time_since_epoch());
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+      ;
+  }
+  while (Clock::now() < t)
+    ;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+// Paces the capture on a grid of absolute deadlines, frame N at start + N /
+// fps, so sleep jitter and slow frames do not accumulate into drift. Sleeps
+// with clock_nanosleep(TIMER_ABSTIME) on CLOCK_MONOTONIC, the clock behind
+// std::chrono::steady_clock, and optionally spins the last stretch for
+// sub-100 us accuracy. A frame that overruns its slot skips the deadlines it
+// missed instead of shifting the grid.
+class FrameScheduler
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  FrameScheduler(int fps, int idleFps, std::chrono::microseconds spin);
+
+  // Restarts the grid at the new rate from the current deadline
+  auto setFps(int fps) -> void;
+  // Sleeps until the next frame deadline. Returns the number of deadlines
+  // that were missed since the previous call.
+  auto wait() -> int;
+  // Sleeps for one idle period, or until fd is readable, e.g. the X
+  // connection receiving damage events. The frame grid restarts on return.
+  auto waitIdle(int fd) -> void;
+
+private:
+  auto deadline(int64_t n) const -> Clock::time_point;
+  auto sleepUntil(Clock::time_point t) const -> void;
+
+  int fps;
+  const int idleFps;
+  const std::chrono::microseconds spin;
+  Clock::time_point origin;
+  int64_t frame = 0;
+};
@@ -0,0 +1,77 @@
+#include "gl-capture.hpp"
+#include <GL/gl.h>
+#include <cstdlib>
+#include <log/log.hpp>
+
+auto GlCapture::create(Display *display, int x, int y, int width, int height, int nBuffers)
+  -> std::unique_ptr<GlCapture>
+{
+  GLint att[] = {GLX_RGBA, GLX_DEPTH_SIZE, 24, GLX_DOUBLEBUFFER, None};
+  XVisualInfo *vi = glXChooseVisual(display, 0, att);
+  if (!vi)
+  {
+    LOG("No suitable visual found");
+    return nullptr;
+  }
+
+  GLXContext glc = glXCreateContext(display, vi, nullptr, GL_TRUE);
+  XFree(vi);
+  if (!glc)
+  {
+    LOG("Cannot create OpenGL context");
+    return nullptr;
+  }
+
+  glXMakeCurrent(display, DefaultRootWindow(display), glc);
+
+  auto capture = std::unique_ptr<GlCapture>{new GlCapture{display, glc, x, y, width, height}};
+  for (auto i = 0; i < nBuffers; ++i)
+    if (!capture->addBuffer())
+      return nullptr;
+  return capture;
+}
+
+GlCapture::GlCapture(Display *display, GLXContext glc, int x, int y, int width, int height)
+  : display(display),
+    glc(glc),
+    x(x),
+    y(y),
+    width(width),
+    height(height),
+    displayHeight(DisplayHeight(display, 0))
+{
+}
+
+GlCapture::~GlCapture()
+{
+  for (auto pixels : buffers)
+    free(pixels);
+  glXMakeCurrent(display, None, nullptr);
+  glXDestroyContext(display, glc);
+}
+
+auto GlCapture::addBuffer() -> bool
+{
+  // aligned_alloc wants the size to be a multiple of the alignment, which an
+  // arbitrary capture rectangle does not guarantee
+  const auto pixels = static_cast<uint8_t *>(std::aligned_alloc(32, (width * height * 4 + 31) / 32 * 32));
+  if (!pixels)
+  {
+    LOG("Cannot allocate a", width, "x", height, "capture buffer");
+    return false;
+  }
+  buffers.push_back(pixels);
+  return true;
+}
+
+auto GlCapture::grab(int buffer) -> std::optional<Frame>
+{
+  const auto pixels = buffers[buffer];
+  glReadBuffer(GL_FRONT);
+  // BGRA matches the framebuffer layout, so the driver does not have to swizzle or repack
+  glReadPixels(x, displayHeight - height - y, width, height, GL_BGRA, GL_UNSIGNED_BYTE, pixels);
+  return Frame{.pixels = pixels,
+               .lineSize = width * 4,
+               .format = Rgb2Yuv::Format::Bgrx32,
+               .rowOrder = Rgb2Yuv::RowOrder::BottomUp};
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "capture.hpp"
+#include <GL/glx.h>
+#include <vector>
+
+// Reads the front buffer with glReadPixels through a GLX context bound to the
+// root window. Must be created and used on the same thread.
+class GlCapture final : public Capture
+{
+public:
+  static auto create(Display *display, int x, int y, int width, int height, int nBuffers)
+    -> std::unique_ptr<GlCapture>;
+  ~GlCapture() final;
+  auto grab(int buffer) -> std::optional<Frame> final;
+
+private:
+  GlCapture(Display *display, GLXContext glc, int x, int y, int width, int height);
+  auto addBuffer() -> bool;
+
+  Display *display;
+  GLXContext glc;
+  int x;
+  int y;
+  int width;
+  int height;
+  int displayHeight;
+  std::vector<uint8_t *> buffers;
+};
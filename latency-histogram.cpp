@@ -0,0 +1,62 @@
+#include "latency-histogram.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+auto LatencyHistogram::bucketOf(int64_t us) -> int
+{
+  const auto v = static_cast<uint32_t>(std::clamp<int64_t>(us, 0, UINT32_MAX));
+  if (v < SubBuckets)
+    return static_cast<int>(v);
+  // The 4 bits below the most significant one pick the sub-bucket
+  const auto shift = std::bit_width(v) - 5;
+  return (shift + 1) * SubBuckets + static_cast<int>((v >> shift) & (SubBuckets - 1));
+}
+
+auto LatencyHistogram::upperBound(int bucket) -> int64_t
+{
+  if (bucket < SubBuckets)
+    return bucket;
+  const auto shift = bucket / SubBuckets - 1;
+  const auto sub = bucket % SubBuckets;
+  return ((int64_t{SubBuckets + sub + 1}) << shift) - 1;
+}
+
+auto LatencyHistogram::record(int64_t us) -> void
+{
+  counts[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+  total.fetch_add(1, std::memory_order_relaxed);
+  sumUs.fetch_add(std::max<int64_t>(us, 0), std::memory_order_relaxed);
+}
+
+auto LatencyHistogram::percentile(double q) const -> int64_t
+{
+  const auto n = count();
+  if (n == 0)
+    return 0;
+  const auto rank = std::max<int64_t>(1, static_cast<int64_t>(std::ceil(q * n)));
+  auto seen = int64_t{0};
+  for (auto i = 0; i < NBuckets; ++i)
+  {
+    seen += counts[i].load(std::memory_order_relaxed);
+    if (seen >= rank)
+      return upperBound(i);
+  }
+  return upperBound(NBuckets - 1);
+}
+
+auto LatencyHistogram::countAtMost(int64_t us) const -> int64_t
+{
+  auto ret = int64_t{0};
+  for (auto i = 0; i < NBuckets && upperBound(i) <= us; ++i)
+    ret += counts[i].load(std::memory_order_relaxed);
+  return ret;
+}
+
+auto LatencyHistogram::reset() -> void
+{
+  for (auto &count : counts)
+    count.store(0, std::memory_order_relaxed);
+  total.store(0, std::memory_order_relaxed);
+  sumUs.store(0, std::memory_order_relaxed);
+}
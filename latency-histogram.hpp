@@ -0,0 +1,36 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// HDR-style log-linear histogram of durations in microseconds. Values below
+// 16 us get a bucket each, above that every power of two is split into 16
+// buckets, so a percentile is off by at most 1/16 of its value. Values are
+// clamped to [0, 2^32) us, a bit over an hour. Recording is a couple of
+// relaxed atomic increments, so pipeline threads record while the metrics
+// endpoint reads; a reader may see a value in the count but not yet in its
+// bucket.
+class LatencyHistogram
+{
+public:
+  auto record(int64_t us) -> void;
+  // Upper bound of the bucket holding the q quantile, 0 when empty
+  auto percentile(double q) const -> int64_t;
+  // Values of at most us; exact when us + 1 is a power of two
+  auto countAtMost(int64_t us) const -> int64_t;
+  auto count() const -> int64_t { return total.load(std::memory_order_relaxed); }
+  auto sum() const -> int64_t { return sumUs.load(std::memory_order_relaxed); }
+  // Not atomic with concurrent recording, values recorded meanwhile may be lost
+  auto reset() -> void;
+
+private:
+  static constexpr auto SubBuckets = 16;
+  static constexpr auto NBuckets = (32 - 4 + 1) * SubBuckets;
+
+  static auto bucketOf(int64_t us) -> int;
+  static auto upperBound(int bucket) -> int64_t;
+
+  std::array<std::atomic<int64_t>, NBuckets> counts = {};
+  std::atomic<int64_t> total = 0;
+  std::atomic<int64_t> sumUs = 0;
+};
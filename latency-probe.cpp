@@ -0,0 +1,92 @@
+#include "latency-probe.hpp"
+#include <algorithm>
+#include <log/log.hpp>
+
+namespace
+{
+  auto toMs(const LatencyHistogram &histogram, double q) -> double
+  {
+    return histogram.percentile(q) / 1000.;
+  }
+} // namespace
+
+auto LatencyProbe::now() -> int64_t
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch())
+    .count();
+}
+
+auto LatencyProbe::onClockReply(int64_t serverTime, int64_t clientTime) -> void
+{
+  const auto receiveTime = now();
+  // Assumes the probe spent as long on the way out as on the way back
+  clockSamples[nextClockSample] =
+    ClockSample{.rtt = receiveTime - serverTime, .offset = clientTime - (serverTime + receiveTime) / 2};
+  nextClockSample = (nextClockSample + 1) % std::ssize(clockSamples);
+  isClockSynced = true;
+}
+
+auto LatencyProbe::onFrameSent(uint32_t sequence, int64_t captureTime) -> void
+{
+  sentFrames[sequence % sentFrames.size()] = SentFrame{.sequence = sequence, .captureTime = captureTime, .sendTime = now()};
+}
+
+auto LatencyProbe::onFrameReport(uint32_t sequence, int64_t receiveTime, int64_t decodeTime, int64_t presentTime)
+  -> void
+{
+  const auto &sent = sentFrames[sequence % sentFrames.size()];
+  if (!isClockSynced || sent.sendTime < 0 || sent.sequence != sequence)
+    return;
+  const auto offset = bestClockSample().offset;
+  captureToSend.record(sent.sendTime - sent.captureTime);
+  sendToReceive.record(receiveTime - offset - sent.sendTime);
+  receiveToDecode.record(decodeTime - receiveTime);
+  decodeToPresent.record(presentTime - decodeTime);
+  captureToPresent.record(presentTime - offset - sent.captureTime);
+}
+
+auto LatencyProbe::bestClockSample() const -> const ClockSample &
+{
+  return *std::min_element(
+    std::begin(clockSamples), std::end(clockSamples), [](const auto &a, const auto &b) { return a.rtt < b.rtt; });
+}
+
+auto LatencyProbe::maybeLog() -> void
+{
+  const auto t = std::chrono::steady_clock::now();
+  if (t - lastLog < std::chrono::seconds{10})
+    return;
+  lastLog = t;
+  if (captureToPresent.count() == 0)
+    return;
+  const auto clockRtt = bestClockSample().rtt;
+  LOG("Latency ms p50/p90/p99 over",
+      captureToPresent.count(),
+      "frames: capture-send",
+      toMs(captureToSend, .5),
+      toMs(captureToSend, .9),
+      toMs(captureToSend, .99),
+      "send-receive",
+      toMs(sendToReceive, .5),
+      toMs(sendToReceive, .9),
+      toMs(sendToReceive, .99),
+      "receive-decode",
+      toMs(receiveToDecode, .5),
+      toMs(receiveToDecode, .9),
+      toMs(receiveToDecode, .99),
+      "decode-present",
+      toMs(decodeToPresent, .5),
+      toMs(decodeToPresent, .9),
+      toMs(decodeToPresent, .99),
+      "total",
+      toMs(captureToPresent, .5),
+      toMs(captureToPresent, .9),
+      toMs(captureToPresent, .99),
+      "clock error up to",
+      clockRtt / 2000.);
+  captureToSend.reset();
+  sendToReceive.reset();
+  receiveToDecode.reset();
+  decodeToPresent.reset();
+  captureToPresent.reset();
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "latency-histogram.hpp"
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+// Glass-to-glass latency of one session, split into the stages a frame goes
+// through: capture to the end of its socket write, send to client receipt,
+// receipt to decoded, and decoded to presented. The client's timestamps are
+// mapped onto the server clock with an NTP-style offset estimated from clock
+// probes over the WebSocket. All times are microseconds since the Unix epoch.
+// Not thread-safe; the session uses it on its strand only.
+class LatencyProbe
+{
+public:
+  // Server time to put in the next clock probe
+  static auto now() -> int64_t;
+
+  // The client echoed a probe sent at serverTime and stamped its own clock
+  auto onClockReply(int64_t serverTime, int64_t clientTime) -> void;
+  // The last part of a video frame left the socket
+  auto onFrameSent(uint32_t sequence, int64_t captureTime) -> void;
+  // Client clock times of a frame
+  auto onFrameReport(uint32_t sequence, int64_t receiveTime, int64_t decodeTime, int64_t presentTime) -> void;
+  // Logs the distributions every 10 s and starts over
+  auto maybeLog() -> void;
+
+private:
+  struct SentFrame
+  {
+    uint32_t sequence = 0;
+    int64_t captureTime = 0;
+    int64_t sendTime = -1;
+  };
+  struct ClockSample
+  {
+    int64_t rtt = INT64_MAX;
+    int64_t offset = 0; // client minus server
+  };
+
+  auto bestClockSample() const -> const ClockSample &;
+
+  std::array<SentFrame, 64> sentFrames;
+  // The sample with the shortest round trip is the least skewed by queueing
+  std::array<ClockSample, 16> clockSamples;
+  int nextClockSample = 0;
+  bool isClockSynced = false;
+  LatencyHistogram captureToSend;
+  LatencyHistogram sendToReceive;
+  LatencyHistogram receiveToDecode;
+  LatencyHistogram decodeToPresent;
+  LatencyHistogram captureToPresent;
+  std::chrono::steady_clock::time_point lastLog = std::chrono::steady_clock::now();
+};
@@ -0,0 +1,618 @@
+// Load generator: opens many WebSocket viewers against a screen-cast server
+// and reports per-client throughput, frame interval jitter and the server's
+// CPU use. Built along with the server, see README.md.
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <json-ser/json-ser.hpp>
+#include <log/log.hpp>
+#include <memory>
+#include <optional>
+#include <random>
+#include <ser/macro.hpp>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+using tcp = asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+  struct Options
+  {
+    std::string host = "127.0.0.1";
+    std::string port = "8090";
+    int clients = 10;
+    int duration = 30; // seconds from the first connect
+    int ramp = 100;    // milliseconds between connects
+    int readKbps = 0;  // read cap per client, 0 reads as fast as the server sends
+    int slowClients = 0;
+    int slowKbps = 500; // read cap of the slow clients
+    int inputRate = 0;  // touch moves and scrolls per second per client
+    std::vector<std::string> codecs; // offered to the server, empty offers all it has
+    int serverPid = 0;               // 0 looks for a process called screen-cast
+    int reportInterval = 5;          // seconds
+  };
+
+  auto split(const std::string &v) -> std::vector<std::string>
+  {
+    auto ret = std::vector<std::string>{};
+    auto ss = std::istringstream{v};
+    for (auto item = std::string{}; std::getline(ss, item, ',');)
+      if (!item.empty())
+        ret.push_back(item);
+    return ret;
+  }
+
+  auto parseOptions(int argc, char **argv) -> Options
+  {
+    auto opts = Options{};
+    const auto options = std::unordered_map<std::string, std::function<void(const std::string &)>>{
+      {"host", [&](const std::string &v) { opts.host = v; }},
+      {"port", [&](const std::string &v) { opts.port = v; }},
+      {"clients", [&](const std::string &v) { opts.clients = std::max(1, std::stoi(v)); }},
+      {"duration", [&](const std::string &v) { opts.duration = std::max(1, std::stoi(v)); }},
+      {"ramp", [&](const std::string &v) { opts.ramp = std::max(0, std::stoi(v)); }},
+      {"read-kbps", [&](const std::string &v) { opts.readKbps = std::max(0, std::stoi(v)); }},
+      {"slow-clients", [&](const std::string &v) { opts.slowClients = std::max(0, std::stoi(v)); }},
+      {"slow-kbps", [&](const std::string &v) { opts.slowKbps = std::max(1, std::stoi(v)); }},
+      {"input-rate", [&](const std::string &v) { opts.inputRate = std::max(0, std::stoi(v)); }},
+      {"codecs", [&](const std::string &v) { opts.codecs = split(v); }},
+      {"server-pid", [&](const std::string &v) { opts.serverPid = std::stoi(v); }},
+      {"report-interval", [&](const std::string &v) { opts.reportInterval = std::max(1, std::stoi(v)); }},
+    };
+
+    for (auto i = 1; i < argc; ++i)
+    {
+      const auto arg = std::string{argv[i]};
+      const auto eq = arg.find('=');
+      if (!arg.starts_with("--") || eq == std::string::npos)
+      {
+        LOG("Expected --option=value, got", arg);
+        exit(1);
+      }
+      const auto name = arg.substr(2, eq - 2);
+      const auto it = options.find(name);
+      if (it == std::end(options))
+      {
+        LOG("Unknown option:", name);
+        exit(1);
+      }
+      try
+      {
+        it->second(arg.substr(eq + 1));
+      }
+      catch (const std::exception &e)
+      {
+        LOG("Invalid value for", name, e.what());
+        exit(1);
+      }
+    }
+    return opts;
+  }
+
+  struct CodecInfo
+  {
+    std::string name;
+    std::string codec;
+    SER_PROPS(name, codec);
+  };
+
+  // Every field of the server's JSON control messages: config, codec and clock
+  struct ServerMsg
+  {
+    std::string type;
+    int width = 0;
+    int height = 0;
+    int captureWidth = 0;
+    int captureHeight = 0;
+    std::vector<CodecInfo> codecs;
+    std::string name;
+    std::string codec;
+    int64_t serverTime = 0;
+    SER_PROPS(type, width, height, captureWidth, captureHeight, codecs, name, codec, serverTime);
+  };
+
+  struct CodecsReply
+  {
+    std::string type = "codecs";
+    std::vector<std::string> codecs;
+    SER_PROPS(type, codecs);
+  };
+
+  struct ClockReply
+  {
+    std::string type = "clock";
+    int64_t serverTime;
+    int64_t clientTime;
+    SER_PROPS(type, serverTime, clientTime);
+  };
+
+  // Only moves and scrolls: taps would click on the streaming host's desktop
+  struct TouchMove
+  {
+    std::string type = "touchmove";
+    float x;
+    float y;
+    SER_PROPS(type, x, y);
+  };
+
+  struct Scroll
+  {
+    std::string type = "scroll";
+    float deltaY;
+    SER_PROPS(type, deltaY);
+  };
+
+  template <typename T>
+  auto toJson(const T &msg) -> std::string
+  {
+    auto ss = std::ostringstream{};
+    jsonSer(ss, msg);
+    return ss.str();
+  }
+
+  // One viewer. All clients run on a single-threaded io_context, so their
+  // handlers never race.
+  class Client : public std::enable_shared_from_this<Client>
+  {
+  public:
+    struct Stats
+    {
+      int id;
+      bool isSlow; // reads at --slow-kbps
+      bool isConnected = false;
+      std::string error;
+      std::string codec;
+      int64_t bytes = 0;
+      int64_t nFrames = 0;
+      int64_t nKeyframes = 0;
+      int64_t nAudio = 0;
+      double seconds = 0; // since the handshake
+      std::vector<float> intervals; // ms between the ends of consecutive frames
+    };
+
+    Client(asio::io_context &ioc, const Options &opts, int id, bool isSlow)
+      : opts(opts),
+        readKbps(isSlow ? opts.slowKbps : opts.readKbps),
+        resolver(ioc),
+        ws(ioc),
+        throttle(ioc),
+        inputTimer(ioc),
+        rng(id),
+        counters{.id = id, .isSlow = isSlow}
+    {
+    }
+
+    auto start() -> void
+    {
+      resolver.async_resolve(
+        opts.host, opts.port, [self = shared_from_this()](beast::error_code ec, tcp::resolver::results_type results) {
+          if (ec)
+            return self->fail("resolve", ec);
+          self->connect(results.begin()->endpoint());
+        });
+    }
+
+    auto stats() const -> Stats
+    {
+      auto ret = counters;
+      if (ret.isConnected)
+        ret.seconds = std::chrono::duration<double>(Clock::now() - connectedAt).count();
+      return ret;
+    }
+
+  private:
+    auto connect(const tcp::endpoint &endpoint) -> void
+    {
+      auto &socket = beast::get_lowest_layer(ws).socket();
+      auto ec = beast::error_code{};
+      socket.open(endpoint.protocol(), ec);
+      // A small receive window makes a slow reader push back on the server
+      // soon, as a client on a congested link would
+      if (!ec && readKbps > 0)
+        socket.set_option(asio::socket_base::receive_buffer_size{64 * 1024}, ec);
+      socket.async_connect(endpoint, [self = shared_from_this()](beast::error_code ec) {
+        if (ec)
+          return self->fail("connect", ec);
+        self->ws.async_handshake(self->opts.host + ":" + self->opts.port, "/", [self](beast::error_code ec) {
+          if (ec)
+            return self->fail("handshake", ec);
+          self->counters.isConnected = true;
+          self->connectedAt = Clock::now();
+          self->doRead();
+          if (self->opts.inputRate > 0)
+            self->doInput();
+        });
+      });
+    }
+
+    auto fail(const char *what, beast::error_code ec) -> void
+    {
+      if (!counters.error.empty())
+        return;
+      LOG("Client", counters.id, what, "failed:", ec.message());
+      counters.error = std::string{what} + ": " + ec.message();
+      if (counters.isConnected)
+        counters.seconds = std::chrono::duration<double>(Clock::now() - connectedAt).count();
+      counters.isConnected = false;
+      throttle.cancel();
+      inputTimer.cancel();
+    }
+
+    auto doRead() -> void
+    {
+      ws.async_read(buffer, [self = shared_from_this()](beast::error_code ec, std::size_t size) {
+        if (ec)
+          return self->fail("read", ec);
+        self->counters.bytes += size;
+        self->onMessage(static_cast<const uint8_t *>(self->buffer.data().data()), size);
+        self->buffer.consume(self->buffer.size());
+        if (self->readKbps == 0)
+        {
+          self->doRead();
+          return;
+        }
+        // Do not read ahead of the byte budget; the server's queue fills up
+        // behind the socket meanwhile
+        const auto due =
+          self->connectedAt + std::chrono::microseconds{self->counters.bytes * 8'000 / self->readKbps};
+        if (due <= Clock::now())
+        {
+          self->doRead();
+          return;
+        }
+        self->throttle.expires_at(due);
+        self->throttle.async_wait([self](beast::error_code ec) {
+          if (!ec)
+            self->doRead();
+        });
+      });
+    }
+
+    auto onMessage(const uint8_t *data, std::size_t size) -> void
+    {
+      if (size == 0)
+        return;
+      switch (data[0])
+      {
+      case 0x01: {
+        // Media header flags: 0x01 keyframe, 0x02 first and 0x04 last part of a frame
+        if (size < 3)
+          return;
+        const auto flags = data[2];
+        if ((flags & 0x03) == 0x03)
+          ++counters.nKeyframes;
+        if (!(flags & 0x04))
+          return;
+        const auto now = Clock::now();
+        if (lastFrameEnd)
+          counters.intervals.push_back(std::chrono::duration<float, std::milli>(now - *lastFrameEnd).count());
+        lastFrameEnd = now;
+        ++counters.nFrames;
+        return;
+      }
+      case 0x02: ++counters.nAudio; return;
+      case 0x03: onControl(std::string{reinterpret_cast<const char *>(data) + 1, size - 1}); return;
+      }
+    }
+
+    auto onControl(const std::string &json) -> void
+    {
+      auto msg = ServerMsg{};
+      try
+      {
+        auto ss = std::istringstream{json};
+        jsonDeser(ss, msg);
+      }
+      catch (const std::exception &e)
+      {
+        LOG("Client", counters.id, "cannot parse", json, e.what());
+        return;
+      }
+
+      if (msg.type == "clock")
+      {
+        const auto clientTime =
+          std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch())
+            .count();
+        send(toJson(ClockReply{.serverTime = msg.serverTime, .clientTime = clientTime}));
+      }
+      else if (msg.type == "codec")
+        counters.codec = msg.name;
+      else if (msg.type == "config")
+      {
+        width = msg.width;
+        height = msg.height;
+        auto reply = CodecsReply{};
+        for (const auto &codec : msg.codecs)
+          if (opts.codecs.empty() || std::find(std::begin(opts.codecs), std::end(opts.codecs), codec.name) !=
+                                       std::end(opts.codecs))
+            reply.codecs.push_back(codec.name);
+        send(toJson(reply));
+      }
+    }
+
+    auto send(std::string json) -> void
+    {
+      outbox.push_back(std::move(json));
+      if (outbox.size() == 1)
+        doWrite();
+    }
+
+    auto doWrite() -> void
+    {
+      ws.text(true);
+      ws.async_write(asio::buffer(outbox.front()), [self = shared_from_this()](beast::error_code ec, std::size_t) {
+        if (ec)
+          return self->fail("write", ec);
+        self->outbox.pop_front();
+        if (!self->outbox.empty())
+          self->doWrite();
+      });
+    }
+
+    auto doInput() -> void
+    {
+      inputTimer.expires_after(std::chrono::microseconds{1'000'000 / opts.inputRate});
+      inputTimer.async_wait([self = shared_from_this()](beast::error_code ec) {
+        if (ec || !self->counters.error.empty())
+          return;
+        // Mostly pointer motion with a scroll now and then, like a user reading
+        if (++self->nInputs % 4 == 0)
+          self->send(toJson(Scroll{.deltaY = self->nInputs % 8 == 0 ? 1.f : -1.f}));
+        else if (self->width > 0 && self->height > 0)
+        {
+          auto dist = std::uniform_real_distribution<float>{0.f, 1.f};
+          self->send(toJson(TouchMove{.x = dist(self->rng) * self->width, .y = dist(self->rng) * self->height}));
+        }
+        self->doInput();
+      });
+    }
+
+    const Options &opts;
+    const int readKbps; // 0 reads as fast as the server sends
+    tcp::resolver resolver;
+    websocket::stream<beast::tcp_stream> ws;
+    beast::flat_buffer buffer;
+    asio::steady_timer throttle;
+    asio::steady_timer inputTimer;
+    std::deque<std::string> outbox; // the front one is being written
+    std::mt19937 rng;
+    int width = 0;
+    int height = 0;
+    int64_t nInputs = 0;
+    Clock::time_point connectedAt;
+    std::optional<Clock::time_point> lastFrameEnd;
+    Stats counters;
+  };
+
+  // CPU time and thread count of the server process from /proc, which only
+  // works when it runs on this machine
+  class ServerProbe
+  {
+  public:
+    explicit ServerProbe(int pid) : pid(pid ? pid : findServer()) {}
+
+    struct Sample
+    {
+      double cpu; // cores busy since the previous sample, 1.0 is one full core
+      int nThreads;
+    };
+
+    auto sample() -> std::optional<Sample>
+    {
+      if (pid <= 0)
+        return std::nullopt;
+      auto f = std::ifstream{"/proc/" + std::to_string(pid) + "/stat"};
+      auto stat = std::string{};
+      if (!std::getline(f, stat))
+        return std::nullopt;
+      // Fields after the parenthesized command name, starting with the state (field 3)
+      auto ss = std::istringstream{stat.substr(stat.rfind(')') + 2)};
+      auto fields = std::vector<std::string>{};
+      for (auto field = std::string{}; ss >> field;)
+        fields.push_back(field);
+      if (fields.size() < 18)
+        return std::nullopt;
+      const auto ticks = std::stoll(fields[11]) + std::stoll(fields[12]); // utime + stime
+      const auto nThreads = std::stoi(fields[17]);
+      const auto now = Clock::now();
+      auto cpu = 0.;
+      if (lastTicks)
+        cpu = (ticks - *lastTicks) / static_cast<double>(sysconf(_SC_CLK_TCK)) /
+              std::chrono::duration<double>(now - lastTime).count();
+      lastTicks = ticks;
+      lastTime = now;
+      return Sample{cpu, nThreads};
+    }
+
+    auto serverPid() const -> int { return pid; }
+
+  private:
+    static auto findServer() -> int
+    {
+      auto ec = std::error_code{};
+      for (const auto &entry : std::filesystem::directory_iterator{"/proc", ec})
+      {
+        const auto name = entry.path().filename().string();
+        if (!std::all_of(std::begin(name), std::end(name), [](char c) { return c >= '0' && c <= '9'; }))
+          continue;
+        auto comm = std::string{};
+        std::getline(std::ifstream{entry.path() / "comm"}, comm);
+        if (comm == "screen-cast")
+          return std::stoi(name);
+      }
+      return 0;
+    }
+
+    const int pid;
+    std::optional<int64_t> lastTicks;
+    Clock::time_point lastTime;
+  };
+
+  auto percentile(std::vector<float> values, double q) -> float
+  {
+    if (values.empty())
+      return 0;
+    const auto n = static_cast<size_t>(q * (values.size() - 1));
+    std::nth_element(std::begin(values), std::begin(values) + n, std::end(values));
+    return values[n];
+  }
+
+  auto printReport(const std::vector<std::shared_ptr<Client>> &clients) -> void
+  {
+    printf("%-6s %-5s %-14s %9s %7s %7s %9s %9s %9s %9s %5s %6s  %s\n",
+           "client",
+           "kind",
+           "codec",
+           "Mbit/s",
+           "frames",
+           "fps",
+           "mean ms",
+           "jitter ms",
+           "p99 ms",
+           "max ms",
+           "keys",
+           "audio",
+           "error");
+    for (const auto &client : clients)
+    {
+      const auto s = client->stats();
+      auto mean = 0.;
+      auto variance = 0.;
+      for (const auto v : s.intervals)
+        mean += v;
+      if (!s.intervals.empty())
+        mean /= s.intervals.size();
+      for (const auto v : s.intervals)
+        variance += (v - mean) * (v - mean);
+      if (!s.intervals.empty())
+        variance /= s.intervals.size();
+      const auto seconds = std::max(s.seconds, 1e-3);
+      printf("%-6d %-5s %-14s %9.2f %7lld %7.1f %9.2f %9.2f %9.2f %9.2f %5lld %6lld  %s\n",
+             s.id,
+             s.isSlow ? "slow" : "full",
+             s.codec.empty() ? "-" : s.codec.c_str(),
+             s.bytes * 8 / seconds / 1e6,
+             static_cast<long long>(s.nFrames),
+             s.nFrames / seconds,
+             mean,
+             std::sqrt(variance),
+             percentile(s.intervals, .99),
+             s.intervals.empty() ? 0.f : *std::max_element(std::begin(s.intervals), std::end(s.intervals)),
+             static_cast<long long>(s.nKeyframes),
+             static_cast<long long>(s.nAudio),
+             s.error.c_str());
+    }
+  }
+} // namespace
+
+auto main(int argc, char **argv) -> int
+{
+  const auto opts = parseOptions(argc, argv);
+  auto ioc = asio::io_context{1};
+  auto clients = std::vector<std::shared_ptr<Client>>{};
+  auto server = ServerProbe{opts.serverPid};
+  if (server.serverPid() > 0)
+    LOG("Server pid", server.serverPid());
+  else
+    LOG("No local screen-cast process found, server CPU is not reported");
+  server.sample();
+
+  // Clients connect one after another, as viewers trickle in
+  auto rampTimer = asio::steady_timer{ioc};
+  auto connectNext = std::function<void()>{};
+  connectNext = [&]() {
+    const auto id = static_cast<int>(clients.size());
+    // The last --slow-clients ones are the slow readers
+    clients.push_back(std::make_shared<Client>(ioc, opts, id, id >= opts.clients - opts.slowClients));
+    clients.back()->start();
+    if (std::ssize(clients) == opts.clients)
+      return;
+    rampTimer.expires_after(std::chrono::milliseconds{opts.ramp});
+    rampTimer.async_wait([&](beast::error_code ec) {
+      if (!ec)
+        connectNext();
+    });
+  };
+  connectNext();
+
+  const auto start = Clock::now();
+  auto lastBytes = int64_t{0};
+  auto lastReport = start;
+  auto peakCpu = 0.;
+  auto peakThreads = 0;
+  auto reportTimer = asio::steady_timer{ioc};
+  auto report = std::function<void()>{};
+  report = [&]() {
+    reportTimer.expires_after(std::chrono::seconds{opts.reportInterval});
+    reportTimer.async_wait([&](beast::error_code ec) {
+      if (ec)
+        return;
+      auto nConnected = 0;
+      auto nFailed = 0;
+      auto bytes = int64_t{0};
+      for (const auto &client : clients)
+      {
+        const auto s = client->stats();
+        nConnected += s.isConnected;
+        nFailed += !s.error.empty();
+        bytes += s.bytes;
+      }
+      const auto now = Clock::now();
+      const auto mbps = (bytes - lastBytes) * 8 / std::chrono::duration<double>(now - lastReport).count() / 1e6;
+      lastBytes = bytes;
+      lastReport = now;
+      if (const auto sample = server.sample())
+      {
+        peakCpu = std::max(peakCpu, sample->cpu);
+        peakThreads = std::max(peakThreads, sample->nThreads);
+        LOG(std::chrono::duration_cast<std::chrono::seconds>(now - start).count(),
+            "s: connected",
+            nConnected,
+            "failed",
+            nFailed,
+            "received",
+            mbps,
+            "Mbit/s, server CPU",
+            sample->cpu * 100,
+            "% threads",
+            sample->nThreads);
+      }
+      else
+        LOG(std::chrono::duration_cast<std::chrono::seconds>(now - start).count(),
+            "s: connected",
+            nConnected,
+            "failed",
+            nFailed,
+            "received",
+            mbps,
+            "Mbit/s");
+      report();
+    });
+  };
+  report();
+
+  auto endTimer = asio::steady_timer{ioc, std::chrono::seconds{opts.duration}};
+  endTimer.async_wait([&](beast::error_code) { ioc.stop(); });
+  ioc.run();
+
+  printReport(clients);
+  if (peakThreads > 0)
+    printf("Server peak CPU %.0f%% of one core, peak %d threads\n", peakCpu * 100, peakThreads);
+  return 0;
+}
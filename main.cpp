@@ -1,29 +1,99 @@
+#include "capture.hpp"
+#include "config.hpp"
+#include "pipeline-bench.hpp"
 #include "session.hpp"
+#include "trace.hpp"
+#include "worker-pool.hpp"
+#include <X11/Xlib.h>
+#include <algorithm>
 #include <log/log.hpp>
+#include <thread>
+#include <vector>
 
-void doAccept(tcp::acceptor &acceptor)
+void doAccept(boost::asio::io_context &ioc, tcp::acceptor &acceptor)
 {
-  acceptor.async_accept([&](boost::system::error_code ec, tcp::socket socket) {
+  // Each connection gets its own strand, so its handlers never run concurrently
+  acceptor.async_accept(boost::asio::make_strand(ioc), [&](boost::system::error_code ec, tcp::socket socket) {
     if (ec)
     {
       LOG("Accept failed:", ec.message());
-      doAccept(acceptor);
+      doAccept(ioc, acceptor);
       return;
     }
     std::make_shared<Session>(std::move(socket))->run();
-    doAccept(acceptor);
+    doAccept(ioc, acceptor);
   });
 }
 
-auto main() -> int
+auto main(int argc, char **argv) -> int
 {
+  // Sessions, capture and cursor threads each talk to X on their own display
+  XInitThreads();
+  config().parse(argc, argv);
+  if (const auto size = headlessScreenSize())
+    config().fitToScreen(size->first, size->second);
+  else
+  {
+    const auto display = XOpenDisplay(nullptr);
+    if (!display)
+    {
+      LOG("Cannot open display");
+      return 1;
+    }
+    config().fitToScreen(DisplayWidth(display, DefaultScreen(display)), DisplayHeight(display, DefaultScreen(display)));
+    XCloseDisplay(display);
+  }
+  LOG("Capture",
+      config().captureWidth,
+      "x",
+      config().captureHeight,
+      "+",
+      config().captureX,
+      "+",
+      config().captureY,
+      "encode",
+      config().width,
+      "x",
+      config().height);
+  LOG("Color conversion kernel:", Rgb2Yuv::kernelName(config().rgb2yuvKernel));
+  WorkerPool::configure(config().convThreads, config().convAffinity);
+  if (config().bench > 0)
+    return runPipelineBench();
+  if (config().trace)
+  {
+    LOG("Tracing, the trace is at /trace");
+    Trace::enable();
+  }
   try
   {
-    auto ioc = boost::asio::io_context{1};
+    // I/O handlers are short; the heavy lifting is on the pipeline threads
+    const auto nThreads = config().ioThreads > 0
+                            ? config().ioThreads
+                            : std::clamp(static_cast<int>(std::thread::hardware_concurrency()) / 2, 1, 4);
+    LOG("I/O threads:", nThreads);
+    auto ioc = boost::asio::io_context{nThreads};
     auto endpoint = tcp::endpoint{tcp::v4(), 8090};
     auto acceptor = tcp::acceptor{ioc, endpoint};
-    doAccept(acceptor);
-    ioc.run();
+    doAccept(ioc, acceptor);
+    const auto runIo = [&ioc]() {
+      Trace::setThreadName("io");
+      try
+      {
+        ioc.run();
+      }
+      catch (const std::exception &e)
+      {
+        // A handler threw on this thread while the others keep running
+        LOG("Error:", e.what());
+        exit(1);
+      }
+    };
+    auto threads = std::vector<std::thread>{};
+    for (auto i = 1; i < nThreads; ++i)
+      threads.emplace_back(runIo);
+    runIo();
+    for (auto &thread : threads)
+      thread.join();
   }
   catch (const std::exception &e)
   {
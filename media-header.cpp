@@ -0,0 +1,50 @@
+#include "media-header.hpp"
+#include <array>
+
+namespace
+{
+  auto putLe(uint8_t *data, uint64_t v, int size) -> void
+  {
+    for (auto i = 0; i < size; ++i)
+      data[i] = static_cast<uint8_t>(v >> (8 * i));
+  }
+
+  auto getLe(const uint8_t *data, int size) -> uint64_t
+  {
+    auto v = uint64_t{0};
+    for (auto i = 0; i < size; ++i)
+      v |= static_cast<uint64_t>(data[i]) << (8 * i);
+    return v;
+  }
+} // namespace
+
+auto MediaHeader::appendTo(Message &message) const -> void
+{
+  auto data = std::array<uint8_t, Size>{};
+  data[0] = Version;
+  data[1] = flags;
+  data[2] = streamId;
+  putLe(data.data() + 3, sequence, 4);
+  putLe(data.data() + 7, static_cast<uint64_t>(captureTime), 8);
+  putLe(data.data() + 15, static_cast<uint64_t>(pts), 8);
+  message.appendHeader(data.data(), Size);
+}
+
+auto MediaHeader::read(const Message &message) -> MediaHeader
+{
+  if (message.headerLength() < 1 + Size)
+    return {};
+  // Past the type byte and the version
+  const auto data = message.headerData() + 2;
+  return MediaHeader{.flags = data[0],
+                     .streamId = data[1],
+                     .sequence = static_cast<uint32_t>(getLe(data + 2, 4)),
+                     .captureTime = static_cast<int64_t>(getLe(data + 6, 8)),
+                     .pts = static_cast<int64_t>(getLe(data + 14, 8))};
+}
+
+auto toCaptureTime(std::chrono::steady_clock::time_point t) -> int64_t
+{
+  const auto wall = std::chrono::system_clock::now() - (std::chrono::steady_clock::now() - t);
+  return std::chrono::duration_cast<std::chrono::microseconds>(wall.time_since_epoch()).count();
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "message.hpp"
+#include <chrono>
+#include <cstdint>
+
+// Header of the video (0x01) and audio (0x02) messages, after the type byte
+// and in little endian:
+//   u8  version, bumped on incompatible changes
+//   u8  flags; video: 0x01 keyframe, 0x02 first and 0x04 last part of a frame
+//   u8  stream id, changes when the session moves to another capture
+//   u32 sequence; video: frame number, shared by the parts of a frame; audio:
+//       packet number
+//   i64 capture time, microseconds since the Unix epoch on the server clock
+//   i64 PTS, microseconds on a timeline the audio and video of a stream share
+struct MediaHeader
+{
+  static constexpr uint8_t Version = 1;
+  static constexpr auto Size = 23;
+
+  uint8_t flags = 0;
+  uint8_t streamId = 0;
+  uint32_t sequence = 0;
+  int64_t captureTime = 0;
+  int64_t pts = 0;
+
+  auto appendTo(Message &message) const -> void;
+  // Reads the header back from a video or audio message
+  static auto read(const Message &message) -> MediaHeader;
+};
+
+// The wall clock time of a steady clock time point, in microseconds since the
+// Unix epoch
+auto toCaptureTime(std::chrono::steady_clock::time_point t) -> int64_t;
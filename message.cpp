@@ -0,0 +1,99 @@
+#include "message.hpp"
+#include <algorithm>
+#include <log/log.hpp>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+  auto poolMutex = std::mutex{};
+  auto pool = std::vector<Message *>{};
+} // namespace
+
+Message::Message() : packet(av_packet_alloc())
+{
+  if (!packet)
+  {
+    LOG("Could not allocate AVPacket");
+    exit(1);
+  }
+}
+
+auto Message::acquire() -> MessageRef
+{
+  auto message = [&]() {
+    auto lock = std::unique_lock{poolMutex};
+    if (pool.empty())
+      return new Message;
+    const auto ret = pool.back();
+    pool.pop_back();
+    return ret;
+  }();
+  message->refs.store(1, std::memory_order_relaxed);
+  return MessageRef{message};
+}
+
+auto Message::release(Message *message) -> void
+{
+  av_packet_unref(message->packet);
+  message->headerSize = 0;
+  message->inlineSize = 0;
+  auto lock = std::unique_lock{poolMutex};
+  pool.push_back(message);
+}
+
+auto Message::setType(uint8_t type) -> void
+{
+  header[0] = type;
+  headerSize = 1;
+}
+
+auto Message::appendHeader(const uint8_t *data, int size) -> void
+{
+  if (headerSize + size > MaxHeaderSize)
+  {
+    LOG("Message header overflow");
+    exit(1);
+  }
+  std::copy(data, data + size, header.data() + headerSize);
+  headerSize += size;
+}
+
+auto Message::takePacket(AVPacket *pkt) -> void
+{
+  av_packet_move_ref(packet, pkt);
+}
+
+auto Message::allocPayload(int size) -> uint8_t *
+{
+  if (av_new_packet(packet, size) < 0)
+  {
+    LOG("Could not allocate message payload");
+    exit(1);
+  }
+  return packet->data;
+}
+
+auto Message::setInlineSize(int size) -> void
+{
+  inlineSize = size;
+}
+
+auto Message::buffers() const -> std::array<boost::asio::const_buffer, 2>
+{
+  const auto payload = packet->data ? boost::asio::const_buffer{packet->data, static_cast<size_t>(packet->size)}
+                                    : boost::asio::const_buffer{inlineBuf.data(), static_cast<size_t>(inlineSize)};
+  return {boost::asio::const_buffer{header.data(), static_cast<size_t>(headerSize)}, payload};
+}
+
+auto Message::size() const -> int
+{
+  return headerSize + (packet->data ? packet->size : inlineSize);
+}
+
+auto MessageRef::reset() -> void
+{
+  if (message && message->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    Message::release(message);
+  message = nullptr;
+}
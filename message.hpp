@@ -0,0 +1,87 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <boost/asio/buffer.hpp>
+#include <cstdint>
+#include <utility>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+class MessageRef;
+
+// WebSocket message built from a small header and a payload. The payload is
+// either an encoded AVPacket moved in from the encoder or an inline buffer an
+// encoder writes into directly, so payload bytes are never copied on the way
+// to the socket. Messages come from a process-wide pool and go back to it when
+// the last reference is dropped; after warm-up nothing is allocated.
+class Message
+{
+public:
+  static constexpr auto MaxHeaderSize = 32;
+  static constexpr auto InlineCapacity = 4000;
+
+  static auto acquire() -> MessageRef;
+
+  auto setType(uint8_t type) -> void;
+  auto type() const -> uint8_t { return header[0]; }
+  // The header including the type
+  auto headerData() const -> const uint8_t * { return header.data(); }
+  auto headerLength() const -> int { return headerSize; }
+  // Adds bytes after the type, up to MaxHeaderSize in total
+  auto appendHeader(const uint8_t *data, int size) -> void;
+  // Takes over the packet's reference, leaving pkt blank
+  auto takePacket(AVPacket *pkt) -> void;
+  auto inlineData() -> uint8_t * { return inlineBuf.data(); }
+  auto setInlineSize(int size) -> void;
+  // Payload too large for the inline buffer; allocated per message, so it is
+  // meant for rare messages like cursor shapes
+  auto allocPayload(int size) -> uint8_t *;
+
+  // Header and payload as one scatter-gather buffer sequence
+  auto buffers() const -> std::array<boost::asio::const_buffer, 2>;
+  auto size() const -> int;
+
+private:
+  friend class MessageRef;
+  Message();
+  static auto release(Message *message) -> void;
+
+  std::atomic<int> refs = 0;
+  std::array<uint8_t, MaxHeaderSize> header;
+  int headerSize = 0;
+  AVPacket *packet;
+  std::array<uint8_t, InlineCapacity> inlineBuf;
+  int inlineSize = 0;
+};
+
+// Shared, thread-safe reference to a pooled Message
+class MessageRef
+{
+public:
+  MessageRef() = default;
+  MessageRef(const MessageRef &other) : message(other.message)
+  {
+    if (message)
+      message->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  MessageRef(MessageRef &&other) noexcept : message(std::exchange(other.message, nullptr)) {}
+  ~MessageRef() { reset(); }
+  auto operator=(MessageRef other) noexcept -> MessageRef &
+  {
+    std::swap(message, other.message);
+    return *this;
+  }
+
+  auto reset() -> void;
+  auto operator->() const -> Message * { return message; }
+  auto operator*() const -> Message & { return *message; }
+  explicit operator bool() const { return message != nullptr; }
+
+private:
+  friend class Message;
+  explicit MessageRef(Message *message) : message(message) {}
+
+  Message *message = nullptr;
+};
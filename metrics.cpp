@@ -0,0 +1,111 @@
+#include "metrics.hpp"
+#include <algorithm>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+  auto registryMutex = std::mutex{};
+  auto streams = std::vector<std::weak_ptr<StreamMetrics>>{};
+  auto sessions = std::vector<std::weak_ptr<SessionMetrics>>{};
+  auto nextStreamId = 0;
+  auto nextSessionId = 0;
+
+  template <typename T>
+  auto alive(std::vector<std::weak_ptr<T>> &list) -> std::vector<std::shared_ptr<T>>
+  {
+    list.erase(std::remove_if(std::begin(list), std::end(list), [](const auto &weak) { return weak.expired(); }),
+               std::end(list));
+    auto ret = std::vector<std::shared_ptr<T>>{};
+    for (const auto &weak : list)
+      if (auto metric = weak.lock())
+        ret.push_back(std::move(metric));
+    return ret;
+  }
+
+  // Prometheus wants cumulative buckets; powers of two from 64 us to 2 s are
+  // bucket edges of the histogram, so these counts are exact
+  auto writeHistogram(std::ostream &os, const std::string &name, const std::string &labels, const LatencyHistogram &h)
+    -> void
+  {
+    for (auto shift = 6; shift <= 21; ++shift)
+    {
+      const auto le = (int64_t{1} << shift) - 1;
+      os << name << "_bucket{" << labels << ",le=\"" << (le + 1) / 1e6 << "\"} " << h.countAtMost(le) << '\n';
+    }
+    const auto count = h.count();
+    os << name << "_bucket{" << labels << ",le=\"+Inf\"} " << count << '\n';
+    os << name << "_sum{" << labels << "} " << h.sum() / 1e6 << '\n';
+    os << name << "_count{" << labels << "} " << count << '\n';
+  }
+
+  auto writeHeader(std::ostream &os, const std::string &name, const char *type, const char *help) -> void
+  {
+    os << "# HELP " << name << ' ' << help << '\n';
+    os << "# TYPE " << name << ' ' << type << '\n';
+  }
+} // namespace
+
+auto registerStream(std::string codec) -> std::shared_ptr<StreamMetrics>
+{
+  auto ret = std::make_shared<StreamMetrics>();
+  ret->codec = std::move(codec);
+  auto lock = std::unique_lock{registryMutex};
+  ret->id = ++nextStreamId;
+  streams.push_back(ret);
+  return ret;
+}
+
+auto registerSession() -> std::shared_ptr<SessionMetrics>
+{
+  auto ret = std::make_shared<SessionMetrics>();
+  auto lock = std::unique_lock{registryMutex};
+  ret->id = ++nextSessionId;
+  sessions.push_back(ret);
+  return ret;
+}
+
+auto renderMetrics() -> std::string
+{
+  auto lock = std::unique_lock{registryMutex};
+  const auto liveStreams = alive(streams);
+  const auto liveSessions = alive(sessions);
+  lock.unlock();
+
+  auto os = std::ostringstream{};
+  os.precision(9);
+
+  writeHeader(os, "screen_cast_stream_stage_seconds", "histogram", "Time spent in a capture or encode stage");
+  for (const auto &stream : liveStreams)
+  {
+    const auto labels = "stream=\"" + std::to_string(stream->id) + "\",codec=\"" + stream->codec + "\",stage=\"";
+    writeHistogram(os, "screen_cast_stream_stage_seconds", labels + "capture\"", stream->capture);
+    writeHistogram(os, "screen_cast_stream_stage_seconds", labels + "cursor\"", stream->cursor);
+    writeHistogram(os, "screen_cast_stream_stage_seconds", labels + "convert\"", stream->convert);
+    writeHistogram(os, "screen_cast_stream_stage_seconds", labels + "encode\"", stream->encode);
+    writeHistogram(os, "screen_cast_stream_stage_seconds", labels + "audio_encode\"", stream->audioEncode);
+  }
+  writeHeader(os, "screen_cast_stream_frames_total", "counter", "Video frames encoded");
+  for (const auto &stream : liveStreams)
+    os << "screen_cast_stream_frames_total{stream=\"" << stream->id << "\"} " << stream->nFrames.load() << '\n';
+  writeHeader(os, "screen_cast_stream_keyframes_total", "counter", "Keyframes encoded");
+  for (const auto &stream : liveStreams)
+    os << "screen_cast_stream_keyframes_total{stream=\"" << stream->id << "\"} " << stream->nKeyframes.load() << '\n';
+
+  writeHeader(os, "screen_cast_session_stage_seconds", "histogram", "Time spent on a session's send path");
+  for (const auto &session : liveSessions)
+  {
+    const auto labels = "session=\"" + std::to_string(session->id) + "\",stage=\"";
+    writeHistogram(os, "screen_cast_session_stage_seconds", labels + "queue_wait\"", session->queueWait);
+    writeHistogram(os, "screen_cast_session_stage_seconds", labels + "socket_write\"", session->socketWrite);
+  }
+  writeHeader(os, "screen_cast_session_frames_dropped_total", "counter", "Video frames dropped on a slow link");
+  for (const auto &session : liveSessions)
+    os << "screen_cast_session_frames_dropped_total{session=\"" << session->id << "\"} " << session->nFramesDropped.load()
+       << '\n';
+  writeHeader(os, "screen_cast_session_bytes_sent_total", "counter", "Bytes written to the WebSocket");
+  for (const auto &session : liveSessions)
+    os << "screen_cast_session_bytes_sent_total{session=\"" << session->id << "\"} " << session->bytesSent.load() << '\n';
+  return os.str();
+}
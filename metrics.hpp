@@ -0,0 +1,37 @@
+#pragma once
+#include "latency-histogram.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Telemetry of one Broadcast's pipelines; in broadcast mode every session
+// watching it shares these
+struct StreamMetrics
+{
+  int id = 0;
+  std::string codec;
+  LatencyHistogram capture;     // screen grab
+  LatencyHistogram cursor;      // one pointer poll, shape fetch included
+  LatencyHistogram convert;     // color conversion and scaling
+  LatencyHistogram encode;      // video encode of one frame
+  LatencyHistogram audioEncode; // Opus encode of one frame
+  std::atomic<int64_t> nFrames = 0;
+  std::atomic<int64_t> nKeyframes = 0;
+};
+
+struct SessionMetrics
+{
+  int id = 0;
+  LatencyHistogram queueWait;   // a video message queued until its write starts
+  LatencyHistogram socketWrite; // async_write of one message
+  std::atomic<int64_t> nFramesDropped = 0;
+  std::atomic<int64_t> bytesSent = 0;
+};
+
+// Metrics are exported while their owner keeps them alive; recording into
+// them is lock-free, only registering and rendering take a lock
+auto registerStream(std::string codec) -> std::shared_ptr<StreamMetrics>;
+auto registerSession() -> std::shared_ptr<SessionMetrics>;
+// Everything alive in the Prometheus text exposition format
+auto renderMetrics() -> std::string;
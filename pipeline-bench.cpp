@@ -0,0 +1,101 @@
+#include "pipeline-bench.hpp"
+#include "config.hpp"
+#include "metrics.hpp"
+#include "video-encoder.hpp"
+#include "video-pipeline.hpp"
+#include <atomic>
+#include <log/log.hpp>
+#include <thread>
+#include <utility>
+
+namespace
+{
+  auto logStage(const char *name, const LatencyHistogram &histogram) -> void
+  {
+    if (histogram.count() == 0)
+      return;
+    const auto ms = [](int64_t us) { return us / 1000.; };
+    LOG(name,
+        "mean",
+        ms(histogram.sum() / histogram.count()),
+        "ms p50",
+        ms(histogram.percentile(.5)),
+        "ms p90",
+        ms(histogram.percentile(.9)),
+        "ms p99",
+        ms(histogram.percentile(.99)),
+        "ms");
+  }
+} // namespace
+
+auto runPipelineBench() -> int
+{
+  // The codec a client that decodes everything would get
+  auto names = std::vector<std::string>{};
+  for (const auto backend : VideoEncoder::available())
+    names.push_back(backend->name);
+  const auto backend = VideoEncoder::negotiate(names);
+  if (!backend)
+  {
+    LOG("No video encoder available");
+    return 1;
+  }
+
+  const auto &c = config();
+  LOG("Benchmark", backend->name, "for", c.bench, "s");
+  const auto metrics = registerStream(backend->name);
+  // Packets come from the encode thread or x264's slice threads, never concurrently
+  auto nBytes = std::atomic<int64_t>{0};
+  auto isKeyframe = false;
+  const auto startTime = std::chrono::steady_clock::now();
+  auto elapsed = 0.;
+  {
+    auto video = VideoPipeline{startTime,
+                               *metrics,
+                               *backend,
+                               c.captureX,
+                               c.captureY,
+                               c.captureWidth,
+                               c.captureHeight,
+                               c.width,
+                               c.height,
+                               [&](AVPacket *pkt, bool isFrameEnd) {
+                                 nBytes += pkt->size;
+                                 isKeyframe |= (pkt->flags & AV_PKT_FLAG_KEY) != 0;
+                                 if (isFrameEnd)
+                                 {
+                                   ++metrics->nFrames;
+                                   if (std::exchange(isKeyframe, false))
+                                     ++metrics->nKeyframes;
+                                 }
+                                 return false;
+                               }};
+    std::this_thread::sleep_for(std::chrono::seconds{c.bench});
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  }
+
+  const auto nFrames = metrics->nFrames.load();
+  LOG("Encoded",
+      nFrames,
+      "frames",
+      c.captureWidth,
+      "x",
+      c.captureHeight,
+      "to",
+      c.width,
+      "x",
+      c.height,
+      "in",
+      elapsed,
+      "s:",
+      nFrames / elapsed,
+      "fps",
+      nBytes.load() * 8 / elapsed / 1000,
+      "kbit/s",
+      metrics->nKeyframes.load(),
+      "keyframes");
+  logStage("Capture", metrics->capture);
+  logStage("Convert", metrics->convert);
+  logStage("Encode", metrics->encode);
+  return nFrames > 0 ? 0 : 1;
+}
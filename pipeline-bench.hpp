@@ -0,0 +1,6 @@
+#pragma once
+
+// Runs the real capture, convert and encode pipeline on the configured
+// capture source for --bench seconds, unpaced and without clients, then logs
+// frame rate, bitrate and stage timings. Returns the process exit code.
+auto runPipelineBench() -> int;
@@ -0,0 +1,87 @@
+#include "rate-controller.hpp"
+#include <algorithm>
+#include <log/log.hpp>
+#include <utility>
+
+namespace
+{
+  using namespace std::chrono_literals;
+  const auto Interval = 1s;
+  const auto CongestedDepth = 2;
+  const auto CongestedBytes = int64_t{512 * 1024};
+  // RTT counts as congested above twice the baseline plus this much jitter
+  const auto RttSlack = 30ms;
+  // Clear windows in a row before settings are relaxed
+  const auto ClearWindows = 3;
+  const auto MinFps = 15;
+} // namespace
+
+RateController::RateController(int crf, int crfMin, int crfMax, int maxFps)
+  : crf(crf), crfMin(crfMin), crfMax(crfMax), fps(maxFps), maxFps(maxFps)
+{
+  minRtts.fill(std::chrono::microseconds::max());
+}
+
+auto RateController::update(const LinkStats &stats) -> std::optional<Decision>
+{
+  window.queuedVideo = std::max(window.queuedVideo, stats.queuedVideo);
+  window.bytesInFlight = std::max(window.bytesInFlight, stats.bytesInFlight);
+  window.rtt = std::max(window.rtt, stats.rtt);
+  window.nDrops += stats.nDrops;
+  if (stats.rtt.count() > 0)
+    windowMinRtt = std::min(windowMinRtt, stats.rtt);
+
+  const auto now = Clock::now();
+  if (now < windowEnd)
+    return std::nullopt;
+  windowEnd = now + Interval;
+  const auto w = std::exchange(window, LinkStats{});
+  minRtts[rttIdx] = std::exchange(windowMinRtt, std::chrono::microseconds::max());
+  rttIdx = (rttIdx + 1) % RttHistory;
+  const auto minRtt = *std::min_element(std::begin(minRtts), std::end(minRtts));
+
+  const auto isRttMeasured = minRtt != std::chrono::microseconds::max();
+  const auto isRttHigh = isRttMeasured && w.rtt > 2 * minRtt + RttSlack;
+  const auto isCongested =
+    w.nDrops > 0 || w.queuedVideo >= CongestedDepth || w.bytesInFlight > CongestedBytes || isRttHigh;
+
+  const auto oldCrf = crf;
+  const auto oldFps = fps;
+  if (isCongested)
+  {
+    nClearWindows = 0;
+    if (crf < crfMax)
+      crf = std::min(crf + (w.nDrops > 0 ? 4 : 2), crfMax);
+    else
+      // Never above the configured rate, which may itself be below the floor
+      fps = std::min(std::max(fps / 2, MinFps), maxFps);
+  }
+  else if (++nClearWindows >= ClearWindows)
+  {
+    nClearWindows = 0;
+    if (fps < maxFps)
+      fps = std::min(fps * 2, maxFps);
+    else
+      crf = std::max(crf - 1, crfMin);
+  }
+
+  if (crf == oldCrf && fps == oldFps)
+    return std::nullopt;
+  LOG("Rate control",
+      isCongested ? "congested" : "clear",
+      "crf",
+      crf,
+      "fps",
+      fps,
+      "queued video",
+      w.queuedVideo,
+      "bytes in flight",
+      w.bytesInFlight,
+      "rtt",
+      std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(w.rtt),
+      "min rtt",
+      std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(isRttMeasured ? minRtt : 0us),
+      "drops",
+      w.nDrops);
+  return Decision{.crf = crf, .fps = fps};
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+// What a session's send path looks like from the encoder's point of view
+struct LinkStats
+{
+  int queuedVideo = 0;       // video frames waiting for the socket
+  int64_t bytesInFlight = 0; // queued bytes plus the message being written
+  std::chrono::microseconds rtt = {}; // WebSocket ping round trip, 0 until measured
+  int nDrops = 0;            // times video was dropped until a keyframe
+};
+
+// Closed loop over the encoder settings. Congestion (a standing video queue,
+// too many bytes in flight, RTT well above its baseline or dropped frames)
+// raises CRF first and halves the frame rate once CRF is at its cap; a link
+// that stays clear for a few seconds gets frame rate back first and then
+// quality, one CRF step at a time.
+class RateController
+{
+public:
+  struct Decision
+  {
+    int crf;
+    int fps;
+  };
+
+  RateController(int crf, int crfMin, int crfMax, int maxFps);
+  // Fed with the worst stats over all viewers on every encoded frame. Returns
+  // new settings at most once per evaluation interval, and only on changes.
+  auto update(const LinkStats &stats) -> std::optional<Decision>;
+
+private:
+  using Clock = std::chrono::steady_clock;
+  // The RTT baseline is the lowest RTT of this many evaluation windows, so it
+  // follows a lasting change of the path, e.g. after a Wi-Fi roam
+  static constexpr auto RttHistory = 10;
+
+  int crf;
+  const int crfMin;
+  const int crfMax;
+  int fps;
+  const int maxFps;
+  LinkStats window;
+  std::chrono::microseconds windowMinRtt = std::chrono::microseconds::max();
+  std::array<std::chrono::microseconds, RttHistory> minRtts;
+  int rttIdx = 0; // next slot of minRtts
+  Clock::time_point windowEnd = Clock::now();
+  int nClearWindows = 0;
+};
@@ -0,0 +1,334 @@
+#include "rgb2yuv-kernels.hpp"
+#include <immintrin.h>
+
+#define AVX2 __attribute__((target("avx2")))
+
+namespace
+{
+  // Deinterleave 16 packed RGB pixels starting at pixel x of line into r, g and b bytes
+  AVX2 auto loadRgb24(const uint8_t *line, int x, __m128i &r8, __m128i &g8, __m128i &b8) -> void
+  {
+    // Load 48 bytes (16 RGB pixels)
+    const auto rgb0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&line[x * 3]));
+    const auto rgb1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&line[x * 3 + 16]));
+    const auto rgb2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&line[x * 3 + 32]));
+
+    // clang-format off
+    const auto r0 = _mm_shuffle_epi8(rgb0, _mm_setr_epi8(
+       0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    const auto g0 = _mm_shuffle_epi8(rgb0, _mm_setr_epi8(
+       1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    const auto b0 = _mm_shuffle_epi8(rgb0, _mm_setr_epi8(
+       2,  5,  8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+
+    const auto r1 = _mm_shuffle_epi8(rgb1, _mm_setr_epi8(
+      -1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14, -1, -1, -1, -1, -1));
+    const auto g1 = _mm_shuffle_epi8(rgb1, _mm_setr_epi8(
+      -1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1));
+    const auto b1 = _mm_shuffle_epi8(rgb1, _mm_setr_epi8(
+      -1, -1, -1, -1, -1,  1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1));
+
+    const auto r2 = _mm_shuffle_epi8(rgb2, _mm_setr_epi8(
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  1,  4,  7, 10, 13));
+    const auto g2 = _mm_shuffle_epi8(rgb2, _mm_setr_epi8(
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14));
+    const auto b2 = _mm_shuffle_epi8(rgb2, _mm_setr_epi8(
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15));
+    // clang-format on
+
+    r8 = _mm_or_si128(r2, _mm_or_si128(r0, r1));
+    g8 = _mm_or_si128(g2, _mm_or_si128(g0, g1));
+    b8 = _mm_or_si128(b2, _mm_or_si128(b0, b1));
+  }
+
+  AVX2 auto convertRgb24(const Rgb2YuvJob &job, int startRow, int endRow) -> void
+  {
+    const __m256i y_coeff_r = _mm256_set1_epi16(66);
+    const __m256i y_coeff_g = _mm256_set1_epi16(129);
+    const __m256i y_coeff_b = _mm256_set1_epi16(25);
+    const __m256i y_const = _mm256_set1_epi16(16 * 256 + 128);
+    // Halved to fit int16, all of them are even; the sums are doubled back before the high byte is taken
+    const __m256i u_coeff_r = _mm256_set1_epi16(-38 / 2);
+    const __m256i u_coeff_g = _mm256_set1_epi16(-74 / 2);
+    const __m256i u_coeff_b = _mm256_set1_epi16(112 / 2);
+    const __m256i v_coeff_r = _mm256_set1_epi16(112 / 2);
+    const __m256i v_coeff_g = _mm256_set1_epi16(-94 / 2);
+    const __m256i v_coeff_b = _mm256_set1_epi16(-18 / 2);
+    const __m256i uv_const = _mm256_set1_epi16(128 / 2 + 128 * 128);
+    const auto simdWidth = job.width / 16 * 16;
+
+    for (auto y = startRow; y < endRow; ++y)
+    {
+      const auto srcLine = job.row(y);
+      const auto src2Line = job.row(y + 1);
+      const auto dstYLine = job.dstY + y * job.dstStrideY;
+      const auto dstULine = job.dstU + (y / 2) * job.dstStrideU;
+      const auto dstVLine = job.dstV + (y / 2) * job.dstStrideV;
+
+      for (auto x = 0; x < simdWidth; x += 16) // Process 16 pixels at a time
+      {
+
+        __m128i r8, g8, b8;
+        loadRgb24(srcLine, x, r8, g8, b8);
+
+        {
+          // // Combine shifted parts into final registers
+          const auto r = _mm256_cvtepu8_epi16(r8);
+          const auto g = _mm256_cvtepu8_epi16(g8);
+          const auto b = _mm256_cvtepu8_epi16(b8);
+
+          {
+            // Compute Y = (66*r + 129*g + 25*b + 128) >> 8 + 16
+            __m256i y_val = _mm256_add_epi16(
+              _mm256_add_epi16(_mm256_mullo_epi16(r, y_coeff_r), _mm256_mullo_epi16(g, y_coeff_g)),
+              _mm256_mullo_epi16(b, y_coeff_b));
+            y_val = _mm256_add_epi16(y_val, y_const);
+
+            // clang-format off
+            auto y_packed = _mm256_shuffle_epi8(y_val, _mm256_setr_epi8(
+              1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1,
+              1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1));
+            // clang-format on
+
+            // Store the packed 128-bit register
+            _mm_storeu_si128(
+              reinterpret_cast<__m128i *>(&dstYLine[x]),
+              _mm256_castsi256_si128(_mm256_permute4x64_epi64(y_packed, _MM_SHUFFLE(2, 0, 2, 0))));
+          }
+        }
+
+        if (y % 2 == 0)
+        {
+          // Split r, g, and b into odd and even components
+          const auto r_odd = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(
+            r8, _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1)));
+          const auto r_even = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(
+            r8, _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1)));
+          const auto g_odd = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(
+            g8, _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1)));
+          const auto g_even = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(
+            g8, _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1)));
+          const auto b_odd = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(
+            b8, _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1)));
+          const auto b_even = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(
+            b8, _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1)));
+
+          __m128i rOdd8, gOdd8, bOdd8;
+          loadRgb24(src2Line, x, rOdd8, gOdd8, bOdd8);
+
+          const auto rOdd_odd = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(
+            rOdd8, _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1)));
+          const auto rOdd_even = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(
+            rOdd8, _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1)));
+          const auto gOdd_odd = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(
+            gOdd8, _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1)));
+          const auto gOdd_even = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(
+            gOdd8, _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1)));
+          const auto bOdd_odd = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(
+            bOdd8, _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1)));
+          const auto bOdd_even = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(
+            bOdd8, _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1)));
+
+          // Compute averages for r, g, and b
+          const auto r_ave = _mm256_srli_epi16(
+            _mm256_add_epi16(_mm256_add_epi16(r_odd, r_even), _mm256_add_epi16(rOdd_odd, rOdd_even)), 2);
+          const auto g_ave = _mm256_srli_epi16(
+            _mm256_add_epi16(_mm256_add_epi16(g_odd, g_even), _mm256_add_epi16(gOdd_odd, gOdd_even)), 2);
+          const auto b_ave = _mm256_srli_epi16(
+            _mm256_add_epi16(_mm256_add_epi16(b_odd, b_even), _mm256_add_epi16(bOdd_odd, bOdd_even)), 2);
+
+          // Compute U
+          auto u_val = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(r_ave, u_coeff_r),
+                                                         _mm256_mullo_epi16(g_ave, u_coeff_g)),
+                                        _mm256_mullo_epi16(b_ave, u_coeff_b));
+          u_val = _mm256_add_epi16(u_val, uv_const);
+
+          // Compute V
+          auto v_val = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(r_ave, v_coeff_r),
+                                                         _mm256_mullo_epi16(g_ave, v_coeff_g)),
+                                        _mm256_mullo_epi16(b_ave, v_coeff_b));
+          v_val = _mm256_add_epi16(v_val, uv_const);
+
+          u_val = _mm256_mullo_epi16(u_val, _mm256_set1_epi16(2));
+          v_val = _mm256_mullo_epi16(v_val, _mm256_set1_epi16(2));
+
+          // clang-format off
+          // Pack and store U and V
+          auto u_packed = _mm256_shuffle_epi8(u_val, _mm256_setr_epi8(
+            1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1,
+            1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1));
+          auto v_packed = _mm256_shuffle_epi8(v_val, _mm256_setr_epi8(
+            1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1,
+            1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1));
+          // clang-format on
+
+          u_packed = _mm256_permute4x64_epi64(u_packed, _MM_SHUFFLE(2, 0, 2, 0));
+          v_packed = _mm256_permute4x64_epi64(v_packed, _MM_SHUFFLE(2, 0, 2, 0));
+
+          _mm_storel_epi64(reinterpret_cast<__m128i *>(&dstULine[x / 2]),
+                           _mm256_castsi256_si128(u_packed));
+          _mm_storel_epi64(reinterpret_cast<__m128i *>(&dstVLine[x / 2]),
+                           _mm256_castsi256_si128(v_packed));
+        }
+      }
+    }
+    if (simdWidth < job.width)
+      rgb2yuvScalarColumns(job, startRow, endRow, simdWidth);
+  }
+
+  // Y = (66*r + 129*g + 25*b + 128) >> 8 + 16 of 16 BGRX pixels. maddubs multiplies unsigned bytes by
+  // signed ones, so 129*g is split in two and g is duplicated into the unused x byte:
+  // [b g r g] * [25 67 66 62]. Neither pair sum overflows int16 and the total stays below 65536.
+  AVX2 auto lumaBgrx32(__m256i p0, __m256i p1) -> __m128i
+  {
+    const auto yDupG = _mm256_setr_epi8(
+      0, 1, 2, 1, 4, 5, 6, 5, 8, 9, 10, 9, 12, 13, 14, 13, 0, 1, 2, 1, 4, 5, 6, 5, 8, 9, 10, 9, 12, 13, 14, 13);
+    const auto yCoeff = _mm256_set1_epi32(25 | 67 << 8 | 66 << 16 | 62 << 24);
+    const auto yConst = _mm256_set1_epi16(16 * 256 + 128);
+
+    const auto m0 = _mm256_maddubs_epi16(_mm256_shuffle_epi8(p0, yDupG), yCoeff);
+    const auto m1 = _mm256_maddubs_epi16(_mm256_shuffle_epi8(p1, yDupG), yCoeff);
+    // hadd leaves pixels in the order 0-3, 8-11 | 4-7, 12-15
+    const auto y = _mm256_srli_epi16(_mm256_add_epi16(_mm256_hadd_epi16(m0, m1), yConst), 8);
+    const auto packed = _mm256_packus_epi16(y, y);
+    return _mm_unpacklo_epi32(_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1));
+  }
+
+  // Converts 16 BGRX pixels of two rows held in a0, a1 and b0, b1
+  AVX2 auto convert16Bgrx32(__m256i a0,
+                            __m256i a1,
+                            __m256i b0,
+                            __m256i b1,
+                            uint8_t *dstY,
+                            uint8_t *dstY2,
+                            uint8_t *dstU,
+                            uint8_t *dstV) -> void
+  {
+    // Gather the same channel of horizontally adjacent pixels: [b0 b1 g0 g1 r0 r1 x0 x1]
+    const auto pairChannels = _mm256_setr_epi8(
+      0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15, 0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15);
+    const auto ones = _mm256_set1_epi8(1);
+    // U = (-38*r - 74*g + 112*b + 128) >> 8 + 128, V = (112*r - 94*g - 18*b + 128) >> 8 + 128 with
+    // the same coefficients and rounding as the packed RGB kernel
+    const auto uCoeff = _mm256_setr_epi16(
+      112, -74, -38, 0, 112, -74, -38, 0, 112, -74, -38, 0, 112, -74, -38, 0);
+    const auto vCoeff = _mm256_setr_epi16(
+      -18, -94, 112, 0, -18, -94, 112, 0, -18, -94, 112, 0, -18, -94, 112, 0);
+    const auto uvConst = _mm256_set1_epi32(128 + 128 * 256);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dstY), lumaBgrx32(a0, a1));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dstY2), lumaBgrx32(b0, b1));
+
+    // Sum 2x2 blocks per channel, then average: 4 int16 [b g r x] per chroma sample
+    const auto sum0 = _mm256_srli_epi16(
+      _mm256_add_epi16(_mm256_maddubs_epi16(_mm256_shuffle_epi8(a0, pairChannels), ones),
+                       _mm256_maddubs_epi16(_mm256_shuffle_epi8(b0, pairChannels), ones)),
+      2);
+    const auto sum1 = _mm256_srli_epi16(
+      _mm256_add_epi16(_mm256_maddubs_epi16(_mm256_shuffle_epi8(a1, pairChannels), ones),
+                       _mm256_maddubs_epi16(_mm256_shuffle_epi8(b1, pairChannels), ones)),
+      2);
+
+    // hadd leaves chroma samples in the order 0, 1, 4, 5 | 2, 3, 6, 7
+    const auto u = _mm256_srai_epi32(
+      _mm256_add_epi32(
+        _mm256_hadd_epi32(_mm256_madd_epi16(sum0, uCoeff), _mm256_madd_epi16(sum1, uCoeff)), uvConst),
+      8);
+    const auto v = _mm256_srai_epi32(
+      _mm256_add_epi32(
+        _mm256_hadd_epi32(_mm256_madd_epi16(sum0, vCoeff), _mm256_madd_epi16(sum1, vCoeff)), uvConst),
+      8);
+    const auto packed = _mm256_packus_epi16(_mm256_packs_epi32(u, v), _mm256_setzero_si256());
+    // Interleave 16-bit pairs of both lanes: u0 u1 u2 u3 u4 u5 u6 u7 v0 v1 v2 v3 v4 v5 v6 v7
+    const auto uv = _mm_unpacklo_epi16(_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1));
+
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(dstU), uv);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(dstV), _mm_unpackhi_epi64(uv, uv));
+  }
+
+  AVX2 auto convertBgrx32(const Rgb2YuvJob &job, int startRow, int endRow) -> void
+  {
+    const auto simdWidth = job.width / 16 * 16;
+    for (auto y = startRow; y < endRow; y += 2)
+    {
+      const auto srcLine = job.row(y);
+      const auto src2Line = job.row(y + 1);
+      const auto dstYLine = job.dstY + y * job.dstStrideY;
+      const auto dstULine = job.dstU + (y / 2) * job.dstStrideU;
+      const auto dstVLine = job.dstV + (y / 2) * job.dstStrideV;
+
+      for (auto x = 0; x < simdWidth; x += 16) // Process 16 pixels of two rows at a time
+      {
+        const auto a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&srcLine[x * 4]));
+        const auto a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&srcLine[x * 4 + 32]));
+        const auto b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&src2Line[x * 4]));
+        const auto b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&src2Line[x * 4 + 32]));
+        convert16Bgrx32(
+          a0, a1, b0, b1, &dstYLine[x], &dstYLine[x + job.dstStrideY], &dstULine[x / 2], &dstVLine[x / 2]);
+      }
+    }
+    if (simdWidth < job.width)
+      rgb2yuvScalarColumns(job, startRow, endRow, simdWidth);
+  }
+
+  // 2:1 box filter of 8 source pixels of two rows into 4 BGRX pixels as int16 [b g r x], rounded
+  // like the scalar kernel: (p0 + p1 + p2 + p3 + 2) >> 2 per channel. Each lane yields 2 pixels.
+  AVX2 auto boxBgrx32(const uint8_t *p, const uint8_t *p2) -> __m256i
+  {
+    const auto pairChannels = _mm256_setr_epi8(
+      0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15, 0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15);
+    const auto ones = _mm256_set1_epi8(1);
+    const auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    const auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p2));
+    const auto sum = _mm256_add_epi16(_mm256_maddubs_epi16(_mm256_shuffle_epi8(a, pairChannels), ones),
+                                      _mm256_maddubs_epi16(_mm256_shuffle_epi8(b, pairChannels), ones));
+    return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(2)), 2);
+  }
+
+  // Source pixels [srcX, srcX + 16) of two rows halved into 8 BGRX pixels
+  AVX2 auto halveBgrx32(const uint8_t *line, const uint8_t *line2, int srcX) -> __m256i
+  {
+    // packus leaves pixel pairs in the order 0-1, 4-5 | 2-3, 6-7
+    const auto packed = _mm256_packus_epi16(boxBgrx32(&line[srcX * 4], &line2[srcX * 4]),
+                                            boxBgrx32(&line[srcX * 4 + 32], &line2[srcX * 4 + 32]));
+    return _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+  }
+
+  AVX2 auto convertBgrx32Half(const Rgb2YuvJob &job, int startRow, int endRow) -> void
+  {
+    const auto simdWidth = job.width / 16 * 16;
+    for (auto y = startRow; y < endRow; y += 2)
+    {
+      const auto srcLine = job.row(2 * y);
+      const auto src2Line = job.row(2 * y + 1);
+      const auto src3Line = job.row(2 * y + 2);
+      const auto src4Line = job.row(2 * y + 3);
+      const auto dstYLine = job.dstY + y * job.dstStrideY;
+      const auto dstULine = job.dstU + (y / 2) * job.dstStrideU;
+      const auto dstVLine = job.dstV + (y / 2) * job.dstStrideV;
+
+      for (auto x = 0; x < simdWidth; x += 16) // Process 16 output pixels of two rows at a time
+      {
+        const auto a0 = halveBgrx32(srcLine, src2Line, 2 * x);
+        const auto a1 = halveBgrx32(srcLine, src2Line, 2 * x + 16);
+        const auto b0 = halveBgrx32(src3Line, src4Line, 2 * x);
+        const auto b1 = halveBgrx32(src3Line, src4Line, 2 * x + 16);
+        convert16Bgrx32(
+          a0, a1, b0, b1, &dstYLine[x], &dstYLine[x + job.dstStrideY], &dstULine[x / 2], &dstVLine[x / 2]);
+      }
+    }
+    if (simdWidth < job.width)
+      rgb2yuvScalarColumns(job, startRow, endRow, simdWidth);
+  }
+} // namespace
+
+auto rgb2yuvAvx2(const Rgb2YuvJob &job, int startRow, int endRow) -> void
+{
+  const auto isBgrx32 = job.srcFormat == Rgb2Yuv::Format::Bgrx32;
+  if (job.isUnscaled())
+    isBgrx32 ? convertBgrx32(job, startRow, endRow) : convertRgb24(job, startRow, endRow);
+  else if (job.isHalf() && isBgrx32)
+    convertBgrx32Half(job, startRow, endRow);
+  else
+    rgb2yuvScalar(job, startRow, endRow);
+}
@@ -0,0 +1,77 @@
+#include "rgb2yuv-kernels.hpp"
+#include <immintrin.h>
+
+#define AVX512 __attribute__((target("avx512bw")))
+
+namespace
+{
+  // Y of 16 BGRX pixels, see the AVX2 kernel for the coefficient split. AVX-512 has no hadd, so the
+  // pair sums are folded to int32 with madd and narrowed with vpmovdb, which keeps pixel order.
+  AVX512 auto lumaBgrx32(__m512i p) -> __m128i
+  {
+    const auto yDupG = _mm512_set4_epi32(0x0d'0e'0d'0c, 0x09'0a'09'08, 0x05'06'05'04, 0x01'02'01'00);
+    const auto yCoeff = _mm512_set1_epi32(25 | 67 << 8 | 66 << 16 | 62 << 24);
+
+    const auto m = _mm512_madd_epi16(_mm512_maddubs_epi16(_mm512_shuffle_epi8(p, yDupG), yCoeff),
+                                     _mm512_set1_epi16(1));
+    return _mm512_cvtepi32_epi8(_mm512_srli_epi32(_mm512_add_epi32(m, _mm512_set1_epi32(16 * 256 + 128)), 8));
+  }
+
+  // One chroma plane for 16 pixels of two rows from their averaged [b g r x] int16 sums. The two
+  // int32 halves of each dot product are added within the qword and vpmovqb keeps the low byte.
+  AVX512 auto chromaBgrx32(__m512i sum, __m512i coeff) -> __m128i
+  {
+    const auto m = _mm512_madd_epi16(sum, coeff);
+    const auto dot = _mm512_add_epi32(m, _mm512_srli_epi64(m, 32));
+    return _mm512_cvtepi64_epi8(_mm512_srai_epi32(_mm512_add_epi32(dot, _mm512_set1_epi32(128 + 128 * 256)), 8));
+  }
+
+  AVX512 auto convertBgrx32(const Rgb2YuvJob &job, int startRow, int endRow) -> void
+  {
+    // Gather the same channel of horizontally adjacent pixels: [b0 b1 g0 g1 r0 r1 x0 x1]
+    const auto pairChannels = _mm512_set4_epi32(0x0f'0b'0e'0a, 0x0d'09'0c'08, 0x07'03'06'02, 0x05'01'04'00);
+    const auto ones = _mm512_set1_epi8(1);
+    const auto uCoeff = _mm512_set1_epi64(static_cast<long long>(0x0000'ffda'ffb6'0070)); // 112 -74 -38 0
+    const auto vCoeff = _mm512_set1_epi64(static_cast<long long>(0x0000'0070'ffa2'ffee)); // -18 -94 112 0
+    const auto simdWidth = job.width / 16 * 16;
+
+    for (auto y = startRow; y < endRow; y += 2)
+    {
+      const auto srcLine = job.row(y);
+      const auto src2Line = job.row(y + 1);
+      const auto dstYLine = job.dstY + y * job.dstStrideY;
+      const auto dstY2Line = dstYLine + job.dstStrideY;
+      const auto dstULine = job.dstU + (y / 2) * job.dstStrideU;
+      const auto dstVLine = job.dstV + (y / 2) * job.dstStrideV;
+
+      for (auto x = 0; x < simdWidth; x += 16) // Process 16 pixels of two rows at a time
+      {
+        const auto a = _mm512_loadu_si512(&srcLine[x * 4]);
+        const auto b = _mm512_loadu_si512(&src2Line[x * 4]);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(&dstYLine[x]), lumaBgrx32(a));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(&dstY2Line[x]), lumaBgrx32(b));
+
+        const auto sum = _mm512_srli_epi16(
+          _mm512_add_epi16(_mm512_maddubs_epi16(_mm512_shuffle_epi8(a, pairChannels), ones),
+                           _mm512_maddubs_epi16(_mm512_shuffle_epi8(b, pairChannels), ones)),
+          2);
+
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(&dstULine[x / 2]), chromaBgrx32(sum, uCoeff));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(&dstVLine[x / 2]), chromaBgrx32(sum, vCoeff));
+      }
+    }
+    if (simdWidth < job.width)
+      rgb2yuvScalarColumns(job, startRow, endRow, simdWidth);
+  }
+} // namespace
+
+// Packed RGB is only produced by legacy readback paths; it shares the AVX2 kernel, and so does
+// scaled input
+auto rgb2yuvAvx512(const Rgb2YuvJob &job, int startRow, int endRow) -> void
+{
+  if (job.srcFormat == Rgb2Yuv::Format::Bgrx32 && job.isUnscaled())
+    convertBgrx32(job, startRow, endRow);
+  else
+    rgb2yuvAvx2(job, startRow, endRow);
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "rgb2yuv.hpp"
+
+// One color conversion request as seen by the row kernels. Rows and columns
+// are in output pixels unless named src.
+struct Rgb2YuvJob
+{
+  const uint8_t *src;
+  int srcLineSize;
+  Rgb2Yuv::Format srcFormat;
+  Rgb2Yuv::RowOrder srcRowOrder;
+  int srcWidth;
+  int srcHeight;
+  int width;
+  int height;
+  uint8_t *dstY;
+  uint8_t *dstU;
+  uint8_t *dstV;
+  int dstStrideY;
+  int dstStrideU;
+  int dstStrideV;
+  // Only set for bilinear scaling, see Rgb2Yuv
+  const std::pair<int, int> *bilinearX;
+  const std::pair<int, int> *bilinearY;
+
+  auto row(int srcY) const -> const uint8_t *
+  {
+    return src + (srcRowOrder == Rgb2Yuv::RowOrder::TopDown ? srcY : srcHeight - srcY - 1) * srcLineSize;
+  }
+  auto isUnscaled() const -> bool { return srcWidth == width && srcHeight == height; }
+  auto isHalf() const -> bool { return srcWidth == 2 * width && srcHeight == 2 * height; }
+};
+
+// Convert rows [startRow, endRow) of the job; both bounds are even. Each kernel
+// lives in its own translation unit and only that code is compiled for its
+// instruction set, so callers must check Rgb2Yuv::isSupported() first. SIMD
+// kernels run 16 pixels at a time and leave the rest of a row, and scaling
+// they have no fast path for, to the scalar kernel.
+auto rgb2yuvScalar(const Rgb2YuvJob &job, int startRow, int endRow) -> void;
+auto rgb2yuvSse41(const Rgb2YuvJob &job, int startRow, int endRow) -> void;
+auto rgb2yuvAvx2(const Rgb2YuvJob &job, int startRow, int endRow) -> void;
+auto rgb2yuvAvx512(const Rgb2YuvJob &job, int startRow, int endRow) -> void;
+
+// Scalar conversion of columns [startX, width), for the tails of SIMD rows
+auto rgb2yuvScalarColumns(const Rgb2YuvJob &job, int startRow, int endRow, int startX) -> void;
@@ -0,0 +1,93 @@
+#include "rgb2yuv-kernels.hpp"
+#include <algorithm>
+
+namespace
+{
+  struct Rgb
+  {
+    int r;
+    int g;
+    int b;
+  };
+
+  // Output pixel (x, y) taken from the source as the job's scale requires:
+  // copied, box filtered 2:1 with rounding, or bilinear with 8-bit weights.
+  auto sample(const Rgb2YuvJob &job, int x, int y) -> Rgb
+  {
+    const auto bytesPerPixel = job.srcFormat == Rgb2Yuv::Format::Bgrx32 ? 4 : 3;
+    const auto rOffset = job.srcFormat == Rgb2Yuv::Format::Bgrx32 ? 2 : 0;
+    const auto bOffset = 2 - rOffset;
+    const auto at = [&](int srcX, int srcY) {
+      const auto pixel = job.row(srcY) + srcX * bytesPerPixel;
+      return Rgb{pixel[rOffset], pixel[1], pixel[bOffset]};
+    };
+
+    if (job.isUnscaled())
+      return at(x, y);
+
+    if (job.isHalf())
+    {
+      const auto p0 = at(2 * x, 2 * y);
+      const auto p1 = at(2 * x + 1, 2 * y);
+      const auto p2 = at(2 * x, 2 * y + 1);
+      const auto p3 = at(2 * x + 1, 2 * y + 1);
+      return Rgb{(p0.r + p1.r + p2.r + p3.r + 2) >> 2,
+                 (p0.g + p1.g + p2.g + p3.g + 2) >> 2,
+                 (p0.b + p1.b + p2.b + p3.b + 2) >> 2};
+    }
+
+    const auto [x0, wx] = job.bilinearX[x];
+    const auto [y0, wy] = job.bilinearY[y];
+    const auto x1 = std::min(x0 + 1, job.srcWidth - 1);
+    const auto y1 = std::min(y0 + 1, job.srcHeight - 1);
+    const auto p00 = at(x0, y0);
+    const auto p01 = at(x1, y0);
+    const auto p10 = at(x0, y1);
+    const auto p11 = at(x1, y1);
+    const auto lerp = [&](int v00, int v01, int v10, int v11) {
+      return (((v00 * (256 - wx) + v01 * wx) * (256 - wy) + (v10 * (256 - wx) + v11 * wx) * wy) + (1 << 15)) >>
+             16;
+    };
+    return Rgb{lerp(p00.r, p01.r, p10.r, p11.r), lerp(p00.g, p01.g, p10.g, p11.g), lerp(p00.b, p01.b, p10.b, p11.b)};
+  }
+} // namespace
+
+// Portable reference: same fixed-point BT.601 math and rounding as the SIMD kernels, so every kernel
+// produces identical output.
+auto rgb2yuvScalarColumns(const Rgb2YuvJob &job, int startRow, int endRow, int startX) -> void
+{
+  for (auto y = startRow; y < endRow; y += 2)
+  {
+    const auto dstYLine = job.dstY + y * job.dstStrideY;
+    const auto dstY2Line = dstYLine + job.dstStrideY;
+    const auto dstULine = job.dstU + (y / 2) * job.dstStrideU;
+    const auto dstVLine = job.dstV + (y / 2) * job.dstStrideV;
+
+    for (auto x = startX; x < job.width; x += 2)
+    {
+      auto rSum = 0;
+      auto gSum = 0;
+      auto bSum = 0;
+      for (auto i = 0; i < 4; ++i)
+      {
+        const auto [r, g, b] = sample(job, x + i % 2, y + i / 2);
+        (i < 2 ? dstYLine : dstY2Line)[x + i % 2] =
+          static_cast<uint8_t>((66 * r + 129 * g + 25 * b + 16 * 256 + 128) >> 8);
+        rSum += r;
+        gSum += g;
+        bSum += b;
+      }
+
+      const auto r = rSum >> 2;
+      const auto g = gSum >> 2;
+      const auto b = bSum >> 2;
+      dstULine[x / 2] = static_cast<uint8_t>((-38 * r - 74 * g + 112 * b + 128 * 256 + 128) >> 8);
+      dstVLine[x / 2] = static_cast<uint8_t>((112 * r - 94 * g - 18 * b + 128 * 256 + 128) >> 8);
+    }
+  }
+}
+
+auto rgb2yuvScalar(const Rgb2YuvJob &job, int startRow, int endRow) -> void
+{
+  rgb2yuvScalarColumns(job, startRow, endRow, 0);
+}
@@ -0,0 +1,252 @@
+#include "rgb2yuv-kernels.hpp"
+#include <immintrin.h>
+
+#define SSE41 __attribute__((target("sse4.1")))
+
+namespace
+{
+  // Deinterleave 16 packed RGB pixels starting at pixel x of line into r, g and b bytes
+  SSE41 auto loadRgb24(const uint8_t *line, int x, __m128i &r8, __m128i &g8, __m128i &b8) -> void
+  {
+    const auto rgb0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&line[x * 3]));
+    const auto rgb1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&line[x * 3 + 16]));
+    const auto rgb2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&line[x * 3 + 32]));
+
+    // clang-format off
+    r8 = _mm_or_si128(
+      _mm_or_si128(
+        _mm_shuffle_epi8(rgb0, _mm_setr_epi8( 0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(rgb1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14, -1, -1, -1, -1, -1))),
+      _mm_shuffle_epi8(rgb2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  1,  4,  7, 10, 13)));
+    g8 = _mm_or_si128(
+      _mm_or_si128(
+        _mm_shuffle_epi8(rgb0, _mm_setr_epi8( 1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(rgb1, _mm_setr_epi8(-1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1))),
+      _mm_shuffle_epi8(rgb2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14)));
+    b8 = _mm_or_si128(
+      _mm_or_si128(
+        _mm_shuffle_epi8(rgb0, _mm_setr_epi8( 2,  5,  8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(rgb1, _mm_setr_epi8(-1, -1, -1, -1, -1,  1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1))),
+      _mm_shuffle_epi8(rgb2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15)));
+    // clang-format on
+  }
+
+  // Y = (66*r + 129*g + 25*b + 128) >> 8 + 16 of 8 pixels widened to int16. The sum wraps as int16
+  // but stays below 65536, so a logical shift gives the right result.
+  SSE41 auto luma8(__m128i r, __m128i g, __m128i b) -> __m128i
+  {
+    const auto y = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)),
+                                               _mm_mullo_epi16(g, _mm_set1_epi16(129))),
+                                 _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(25)),
+                                               _mm_set1_epi16(16 * 256 + 128)));
+    return _mm_srli_epi16(y, 8);
+  }
+
+  SSE41 auto luma16(__m128i r8, __m128i g8, __m128i b8) -> __m128i
+  {
+    const auto lo = luma8(_mm_cvtepu8_epi16(r8), _mm_cvtepu8_epi16(g8), _mm_cvtepu8_epi16(b8));
+    const auto hi = luma8(_mm_cvtepu8_epi16(_mm_srli_si128(r8, 8)),
+                          _mm_cvtepu8_epi16(_mm_srli_si128(g8, 8)),
+                          _mm_cvtepu8_epi16(_mm_srli_si128(b8, 8)));
+    return _mm_packus_epi16(lo, hi);
+  }
+
+  SSE41 auto convertRgb24(const Rgb2YuvJob &job, int startRow, int endRow) -> void
+  {
+    const auto ones = _mm_set1_epi8(1);
+    const auto uvConst = _mm_set1_epi16(static_cast<int16_t>(128 * 256 + 128));
+    const auto simdWidth = job.width / 16 * 16;
+
+    for (auto y = startRow; y < endRow; y += 2)
+    {
+      const auto srcLine = job.row(y);
+      const auto src2Line = job.row(y + 1);
+      const auto dstYLine = job.dstY + y * job.dstStrideY;
+      const auto dstY2Line = dstYLine + job.dstStrideY;
+      const auto dstULine = job.dstU + (y / 2) * job.dstStrideU;
+      const auto dstVLine = job.dstV + (y / 2) * job.dstStrideV;
+
+      for (auto x = 0; x < simdWidth; x += 16) // Process 16 pixels of two rows at a time
+      {
+        __m128i r8, g8, b8;
+        loadRgb24(srcLine, x, r8, g8, b8);
+        __m128i r28, g28, b28;
+        loadRgb24(src2Line, x, r28, g28, b28);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(&dstYLine[x]), luma16(r8, g8, b8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(&dstY2Line[x]), luma16(r28, g28, b28));
+
+        // Average 2x2 blocks: maddubs with ones adds horizontally adjacent bytes
+        const auto r = _mm_srli_epi16(
+          _mm_add_epi16(_mm_maddubs_epi16(r8, ones), _mm_maddubs_epi16(r28, ones)), 2);
+        const auto g = _mm_srli_epi16(
+          _mm_add_epi16(_mm_maddubs_epi16(g8, ones), _mm_maddubs_epi16(g28, ones)), 2);
+        const auto b = _mm_srli_epi16(
+          _mm_add_epi16(_mm_maddubs_epi16(b8, ones), _mm_maddubs_epi16(b28, ones)), 2);
+
+        // U = (-38*r - 74*g + 112*b + 128) >> 8 + 128, V = (112*r - 94*g - 18*b + 128) >> 8 + 128
+        const auto u = _mm_srli_epi16(
+          _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(-38)), _mm_mullo_epi16(g, _mm_set1_epi16(-74))),
+                        _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(112)), uvConst)),
+          8);
+        const auto v = _mm_srli_epi16(
+          _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(112)), _mm_mullo_epi16(g, _mm_set1_epi16(-94))),
+                        _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(-18)), uvConst)),
+          8);
+        const auto uv = _mm_packus_epi16(u, v);
+
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(&dstULine[x / 2]), uv);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(&dstVLine[x / 2]), _mm_srli_si128(uv, 8));
+      }
+    }
+    if (simdWidth < job.width)
+      rgb2yuvScalarColumns(job, startRow, endRow, simdWidth);
+  }
+
+  // Y of 8 BGRX pixels, see the AVX2 kernel for the coefficient split
+  SSE41 auto lumaBgrx32(__m128i p0, __m128i p1) -> __m128i
+  {
+    const auto yDupG = _mm_setr_epi8(0, 1, 2, 1, 4, 5, 6, 5, 8, 9, 10, 9, 12, 13, 14, 13);
+    const auto yCoeff = _mm_set1_epi32(25 | 67 << 8 | 66 << 16 | 62 << 24);
+
+    const auto m0 = _mm_maddubs_epi16(_mm_shuffle_epi8(p0, yDupG), yCoeff);
+    const auto m1 = _mm_maddubs_epi16(_mm_shuffle_epi8(p1, yDupG), yCoeff);
+    return _mm_srli_epi16(_mm_add_epi16(_mm_hadd_epi16(m0, m1), _mm_set1_epi16(16 * 256 + 128)), 8);
+  }
+
+  // Sums of 2x2 blocks per channel for 4 pixels of two rows, averaged: [b g r x] int16 per sample
+  SSE41 auto chromaSumBgrx32(__m128i a, __m128i b) -> __m128i
+  {
+    const auto pairChannels = _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15);
+    const auto ones = _mm_set1_epi8(1);
+    return _mm_srli_epi16(_mm_add_epi16(_mm_maddubs_epi16(_mm_shuffle_epi8(a, pairChannels), ones),
+                                        _mm_maddubs_epi16(_mm_shuffle_epi8(b, pairChannels), ones)),
+                          2);
+  }
+
+  // Dot product of 4 chroma sums with [cb cg cr 0], rounded and shifted to int32 samples
+  SSE41 auto chromaBgrx32(__m128i s0, __m128i s1, __m128i coeff) -> __m128i
+  {
+    return _mm_srai_epi32(
+      _mm_add_epi32(_mm_hadd_epi32(_mm_madd_epi16(s0, coeff), _mm_madd_epi16(s1, coeff)),
+                    _mm_set1_epi32(128 + 128 * 256)),
+      8);
+  }
+
+  // Converts 16 BGRX pixels of two rows held in a[] and b[]
+  SSE41 auto convert16Bgrx32(const __m128i a[4],
+                             const __m128i b[4],
+                             uint8_t *dstY,
+                             uint8_t *dstY2,
+                             uint8_t *dstU,
+                             uint8_t *dstV) -> void
+  {
+    const auto uCoeff = _mm_setr_epi16(112, -74, -38, 0, 112, -74, -38, 0);
+    const auto vCoeff = _mm_setr_epi16(-18, -94, 112, 0, -18, -94, 112, 0);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dstY),
+                     _mm_packus_epi16(lumaBgrx32(a[0], a[1]), lumaBgrx32(a[2], a[3])));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dstY2),
+                     _mm_packus_epi16(lumaBgrx32(b[0], b[1]), lumaBgrx32(b[2], b[3])));
+
+    const auto s0 = chromaSumBgrx32(a[0], b[0]);
+    const auto s1 = chromaSumBgrx32(a[1], b[1]);
+    const auto s2 = chromaSumBgrx32(a[2], b[2]);
+    const auto s3 = chromaSumBgrx32(a[3], b[3]);
+    const auto u = _mm_packs_epi32(chromaBgrx32(s0, s1, uCoeff), chromaBgrx32(s2, s3, uCoeff));
+    const auto v = _mm_packs_epi32(chromaBgrx32(s0, s1, vCoeff), chromaBgrx32(s2, s3, vCoeff));
+    const auto uv = _mm_packus_epi16(u, v);
+
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(dstU), uv);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(dstV), _mm_srli_si128(uv, 8));
+  }
+
+  SSE41 auto convertBgrx32(const Rgb2YuvJob &job, int startRow, int endRow) -> void
+  {
+    const auto simdWidth = job.width / 16 * 16;
+    for (auto y = startRow; y < endRow; y += 2)
+    {
+      const auto srcLine = job.row(y);
+      const auto src2Line = job.row(y + 1);
+      const auto dstYLine = job.dstY + y * job.dstStrideY;
+      const auto dstULine = job.dstU + (y / 2) * job.dstStrideU;
+      const auto dstVLine = job.dstV + (y / 2) * job.dstStrideV;
+
+      for (auto x = 0; x < simdWidth; x += 16) // Process 16 pixels of two rows at a time
+      {
+        __m128i a[4];
+        __m128i b[4];
+        for (auto i = 0; i < 4; ++i)
+        {
+          a[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&srcLine[x * 4 + i * 16]));
+          b[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&src2Line[x * 4 + i * 16]));
+        }
+        convert16Bgrx32(
+          a, b, &dstYLine[x], &dstYLine[x + job.dstStrideY], &dstULine[x / 2], &dstVLine[x / 2]);
+      }
+    }
+    if (simdWidth < job.width)
+      rgb2yuvScalarColumns(job, startRow, endRow, simdWidth);
+  }
+
+  // 2:1 box filter of 4 source pixels of two rows into 2 BGRX pixels as int16 [b g r x], rounded like
+  // the scalar kernel: (p0 + p1 + p2 + p3 + 2) >> 2 per channel
+  SSE41 auto boxBgrx32(const uint8_t *p, const uint8_t *p2) -> __m128i
+  {
+    const auto pairChannels = _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15);
+    const auto ones = _mm_set1_epi8(1);
+    const auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    const auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p2));
+    const auto sum = _mm_add_epi16(_mm_maddubs_epi16(_mm_shuffle_epi8(a, pairChannels), ones),
+                                   _mm_maddubs_epi16(_mm_shuffle_epi8(b, pairChannels), ones));
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+  }
+
+  // Source pixels [srcX, srcX + 8) of two rows halved into 4 BGRX pixels
+  SSE41 auto halveBgrx32(const uint8_t *line, const uint8_t *line2, int srcX) -> __m128i
+  {
+    return _mm_packus_epi16(boxBgrx32(&line[srcX * 4], &line2[srcX * 4]),
+                            boxBgrx32(&line[srcX * 4 + 16], &line2[srcX * 4 + 16]));
+  }
+
+  SSE41 auto convertBgrx32Half(const Rgb2YuvJob &job, int startRow, int endRow) -> void
+  {
+    const auto simdWidth = job.width / 16 * 16;
+    for (auto y = startRow; y < endRow; y += 2)
+    {
+      const auto srcLine = job.row(2 * y);
+      const auto src2Line = job.row(2 * y + 1);
+      const auto src3Line = job.row(2 * y + 2);
+      const auto src4Line = job.row(2 * y + 3);
+      const auto dstYLine = job.dstY + y * job.dstStrideY;
+      const auto dstULine = job.dstU + (y / 2) * job.dstStrideU;
+      const auto dstVLine = job.dstV + (y / 2) * job.dstStrideV;
+
+      for (auto x = 0; x < simdWidth; x += 16) // Process 16 output pixels of two rows at a time
+      {
+        __m128i a[4];
+        __m128i b[4];
+        for (auto i = 0; i < 4; ++i)
+        {
+          a[i] = halveBgrx32(srcLine, src2Line, 2 * x + i * 8);
+          b[i] = halveBgrx32(src3Line, src4Line, 2 * x + i * 8);
+        }
+        convert16Bgrx32(
+          a, b, &dstYLine[x], &dstYLine[x + job.dstStrideY], &dstULine[x / 2], &dstVLine[x / 2]);
+      }
+    }
+    if (simdWidth < job.width)
+      rgb2yuvScalarColumns(job, startRow, endRow, simdWidth);
+  }
+} // namespace
+
+auto rgb2yuvSse41(const Rgb2YuvJob &job, int startRow, int endRow) -> void
+{
+  const auto isBgrx32 = job.srcFormat == Rgb2Yuv::Format::Bgrx32;
+  if (job.isUnscaled())
+    isBgrx32 ? convertBgrx32(job, startRow, endRow) : convertRgb24(job, startRow, endRow);
+  else if (job.isHalf() && isBgrx32)
+    convertBgrx32Half(job, startRow, endRow);
+  else
+    rgb2yuvScalar(job, startRow, endRow);
+}
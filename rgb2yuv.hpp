@@ -1,43 +1,57 @@
 #pragma once
-#include <condition_variable>
-#include <mutex>
-#include <thread>
+#include <cstdint>
+#include <optional>
+#include <string_view>
 #include <vector>
 
+class WorkerPool;
+struct Rgb2YuvJob;
+
 class Rgb2Yuv
 {
 public:
-  Rgb2Yuv(int nThreads, int w, int h);
-  ~Rgb2Yuv();
-  void convert(const uint8_t *src, int srcLineSize, uint8_t *const dst[], const int dstStride[]);
-
-private:
-  void worker(int threadId);
-
-  int width;
-  int height;
-
-  struct ThreadData
-  {
-    int startRow;
-    int endRow;
-    bool ready = false;
-    std::thread thread;
+  enum class Format {
+    Rgb24,  // packed R, G, B as returned by glReadPixels(GL_RGB)
+    Bgrx32, // B, G, R and an ignored X/alpha byte, native to X servers, XShm and GL_BGRA
+  };
+  enum class RowOrder {
+    TopDown,  // first row of src is the top line of the picture (X images)
+    BottomUp, // first row of src is the bottom line of the picture (glReadPixels)
+  };
+  enum class Kernel {
+    Scalar,
+    Sse41,
+    Avx2,
+    Avx512,
   };
 
-  std::vector<ThreadData> threadsData;
+  // Fastest kernel supported by the CPU we are running on
+  static Kernel detectKernel();
+  static bool isSupported(Kernel kernel);
+  // Accepts scalar, sse4.1, avx2, avx512 and auto
+  static std::optional<Kernel> parseKernel(std::string_view name);
+  static const char *kernelName(Kernel kernel);
 
-  const uint8_t *src;
-  int srcLineSize;
-  uint8_t *dstY;
-  uint8_t *dstU;
-  uint8_t *dstV;
-  int dstStrideY;
-  int dstStrideU;
-  int dstStrideV;
+  // Converts a srcW x srcH picture to a w x h one; both output sizes must be
+  // even. Scaling is fused into the conversion: exactly 2:1 is a box filter the
+  // SIMD kernels run for BGRX input, any other ratio is bilinear and scalar.
+  // The picture is converted in bands of rows spread over the pool's threads.
+  Rgb2Yuv(WorkerPool &pool, int srcW, int srcH, int w, int h, Kernel kernel = detectKernel());
+  void convert(const uint8_t *src,
+               int srcLineSize,
+               Format srcFormat,
+               RowOrder srcRowOrder,
+               uint8_t *const dst[],
+               const int dstStride[]);
 
-  std::mutex mutex;
-  std::condition_variable cvThread;
-  std::condition_variable cvMain;
-  bool stop;
+private:
+  WorkerPool &pool;
+  int srcWidth;
+  int srcHeight;
+  int width;
+  int height;
+  // Bilinear taps per output column and row: source index and 8-bit weight of the next one
+  std::vector<std::pair<int, int>> bilinearX;
+  std::vector<std::pair<int, int>> bilinearY;
+  void (*kernel)(const Rgb2YuvJob &job, int startRow, int endRow);
 };
@@ -0,0 +1,63 @@
+#include "screen-capture.hpp"
+#include "config.hpp"
+#include "frame-scheduler.hpp"
+#include "gl-capture.hpp"
+#include "shm-capture.hpp"
+#include <log/log.hpp>
+
+auto ScreenCapture::create(int x, int y, int width, int height, int nBuffers) -> std::unique_ptr<ScreenCapture>
+{
+  const auto display = XOpenDisplay(nullptr);
+  if (!display)
+  {
+    LOG("Cannot open display");
+    return nullptr;
+  }
+
+  auto backend = std::unique_ptr<Capture>{};
+  if (config().capture == "shm")
+  {
+    backend = ShmCapture::create(display, x, y, width, height, nBuffers);
+    if (backend)
+      LOG("Capture backend: XShm");
+    else
+      LOG("XShm capture is not available, falling back to GL");
+  }
+  if (!backend)
+  {
+    backend = GlCapture::create(display, x, y, width, height, nBuffers);
+    if (backend)
+      LOG("Capture backend: GL");
+  }
+  if (!backend)
+  {
+    XCloseDisplay(display);
+    return nullptr;
+  }
+  return std::unique_ptr<ScreenCapture>{new ScreenCapture{display, std::move(backend), x, y, width, height}};
+}
+
+ScreenCapture::ScreenCapture(
+  Display *display, std::unique_ptr<Capture> backend, int x, int y, int width, int height)
+  : display(display, XCloseDisplay), backend(std::move(backend)), damage(display, x, y, width, height)
+{
+}
+
+auto ScreenCapture::grab(int buffer) -> std::optional<Frame>
+{
+  return backend->grab(buffer);
+}
+
+auto ScreenCapture::poll() -> bool
+{
+  return damage.poll();
+}
+
+auto ScreenCapture::waitIdle(FrameScheduler &scheduler) -> void
+{
+  // Events Xlib already read off the socket would not wake the idle wait
+  if (XQLength(display.get()) == 0)
+    scheduler.waitIdle(ConnectionNumber(display.get()));
+  else
+    scheduler.wait();
+}
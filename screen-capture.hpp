@@ -0,0 +1,26 @@
+#pragma once
+#include "capture.hpp"
+#include "damage-tracker.hpp"
+#include <X11/Xlib.h>
+
+// The X screen: owns the display connection the shm or GL backend grabs
+// through and the XDamage tracking that tells the pipeline when the capture
+// area changed. Must be created and used on the same thread.
+class ScreenCapture final : public Capture
+{
+public:
+  static auto create(int x, int y, int width, int height, int nBuffers) -> std::unique_ptr<ScreenCapture>;
+  auto grab(int buffer) -> std::optional<Frame> final;
+  auto poll() -> bool final;
+  auto waitIdle(FrameScheduler &scheduler) -> void final;
+
+private:
+  ScreenCapture(Display *display, std::unique_ptr<Capture> backend, int x, int y, int width, int height);
+
+  // Declared first so it is closed after the backend and the damage tracker
+  std::unique_ptr<Display, int (*)(Display *)> display;
+  std::unique_ptr<Capture> backend;
+  // The cursor is not part of the captured image, it goes to the clients on
+  // its own channel, so pointer motion does not damage the frame
+  DamageTracker damage;
+};
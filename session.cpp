@@ -1,4 +1,6 @@
 #include "session.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 #include "web-socket-session.hpp"
 #include <fstream>
 #include <log/log.hpp>
@@ -51,6 +53,19 @@ void Session::handleHttpRequest()
     return r;
   }();
 
+  // Scraped by Prometheus; every streaming host serves its own
+  if (path == "/metrics")
+  {
+    sendResponse("text/plain; version=0.0.4", renderMetrics());
+    return;
+  }
+  // The most recent pipeline spans, for chrome://tracing or Perfetto
+  if (path == "/trace")
+  {
+    sendResponse("application/json", Trace::toJson());
+    return;
+  }
+
   const auto content = [&]() {
     const auto fullPath = "." + path; // Assuming files are in the current directory
 
@@ -83,12 +98,17 @@ void Session::handleHttpRequest()
       return "application/octet-stream";
   }();
 
+  sendResponse(contentType, content);
+}
+
+void Session::sendResponse(const std::string &contentType, std::string body)
+{
   LOG("Build the response");
   auto res = std::make_shared<http::response<http::string_body>>(http::status::ok, req.version());
   res->set(http::field::server, BOOST_BEAST_VERSION_STRING);
   res->set(http::field::content_type, contentType);
   res->keep_alive(req.keep_alive());
-  res->body() = content;
+  res->body() = std::move(body);
   res->prepare_payload();
 
   LOG("Send the response");
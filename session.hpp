@@ -21,5 +21,6 @@ private:
   auto doRead() -> void;
   auto handleRequest() -> void;
   auto handleHttpRequest() -> void;
+  auto sendResponse(const std::string &contentType, std::string body) -> void;
   auto sendNotFoundResponse(const std::string &target) -> void;
 };
@@ -0,0 +1,143 @@
+#include "shm-capture.hpp"
+#include <log/log.hpp>
+#include <mutex>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+namespace
+{
+  // XShmAttach() only queues the request; a server that cannot map the
+  // segment, e.g. over TCP, answers with an asynchronous BadAccess that the
+  // default handler turns into exit(). The handler is process-wide, so
+  // attaches are serialized and errors of other displays are passed on.
+  auto attachMutex = std::mutex{};
+  Display *attachingDisplay = nullptr;
+  auto attachError = 0;
+  XErrorHandler prevHandler = nullptr;
+
+  auto onAttachError(Display *display, XErrorEvent *event) -> int
+  {
+    if (display != attachingDisplay)
+      return prevHandler ? prevHandler(display, event) : 0;
+    attachError = event->error_code;
+    return 0;
+  }
+} // namespace
+
+auto ShmCapture::create(Display *display, int x, int y, int width, int height, int nBuffers)
+  -> std::unique_ptr<ShmCapture>
+{
+  if (!XShmQueryExtension(display))
+  {
+    LOG("MIT-SHM extension is not supported");
+    return nullptr;
+  }
+
+  auto capture = std::unique_ptr<ShmCapture>{new ShmCapture{display, x, y}};
+  for (auto i = 0; i < nBuffers; ++i)
+    if (!capture->addBuffer(width, height))
+      return nullptr;
+  return capture;
+}
+
+ShmCapture::ShmCapture(Display *display, int x, int y) : display(display), x(x), y(y) {}
+
+ShmCapture::~ShmCapture()
+{
+  for (auto &buffer : buffers)
+    XShmDetach(display, &buffer.shmInfo);
+  XSync(display, False);
+  for (auto &buffer : buffers)
+  {
+    shmdt(buffer.shmInfo.shmaddr);
+    buffer.image->data = nullptr;
+    XDestroyImage(buffer.image);
+  }
+}
+
+auto ShmCapture::addBuffer(int width, int height) -> bool
+{
+  const auto screen = DefaultScreen(display);
+  auto shmInfo = XShmSegmentInfo{};
+  const auto image = XShmCreateImage(display,
+                                     DefaultVisual(display, screen),
+                                     DefaultDepth(display, screen),
+                                     ZPixmap,
+                                     nullptr,
+                                     &shmInfo,
+                                     width,
+                                     height);
+  if (!image)
+  {
+    LOG("XShmCreateImage failed");
+    return false;
+  }
+
+  if (image->bits_per_pixel != 32 || image->red_mask != 0xff0000 || image->green_mask != 0x00ff00 ||
+      image->blue_mask != 0x0000ff || image->byte_order != LSBFirst)
+  {
+    LOG("Unsupported XShm pixel layout, bpp:", image->bits_per_pixel);
+    XDestroyImage(image);
+    return false;
+  }
+
+  shmInfo.shmid = shmget(IPC_PRIVATE, image->bytes_per_line * image->height, IPC_CREAT | 0600);
+  if (shmInfo.shmid < 0)
+  {
+    LOG("shmget failed");
+    XDestroyImage(image);
+    return false;
+  }
+
+  shmInfo.shmaddr = image->data = static_cast<char *>(shmat(shmInfo.shmid, nullptr, 0));
+  // The segment is destroyed once both we and the X server detach from it
+  shmctl(shmInfo.shmid, IPC_RMID, nullptr);
+  if (shmInfo.shmaddr == reinterpret_cast<char *>(-1))
+  {
+    LOG("shmat failed");
+    image->data = nullptr;
+    XDestroyImage(image);
+    return false;
+  }
+
+  shmInfo.readOnly = False;
+  const auto isAttached = [&]() {
+    auto lock = std::unique_lock{attachMutex};
+    attachingDisplay = display;
+    attachError = 0;
+    prevHandler = XSetErrorHandler(onAttachError);
+    const auto ret = XShmAttach(display, &shmInfo);
+    XSync(display, False);
+    XSetErrorHandler(prevHandler);
+    attachingDisplay = nullptr;
+    if (attachError != 0)
+      LOG("XShmAttach failed with X error", attachError);
+    return ret && attachError == 0;
+  }();
+  if (!isAttached)
+  {
+    LOG("XShmAttach failed");
+    shmdt(shmInfo.shmaddr);
+    image->data = nullptr;
+    XDestroyImage(image);
+    return false;
+  }
+
+  buffers.push_back(Buffer{.image = image, .shmInfo = shmInfo});
+  return true;
+}
+
+auto ShmCapture::grab(int buffer) -> std::optional<Frame>
+{
+  const auto image = buffers[buffer].image;
+  if (!XShmGetImage(display, DefaultRootWindow(display), image, x, y, AllPlanes))
+  {
+    LOG("XShmGetImage failed");
+    return std::nullopt;
+  }
+
+  return Frame{.pixels = reinterpret_cast<uint8_t *>(image->data),
+               .lineSize = image->bytes_per_line,
+               .format = Rgb2Yuv::Format::Bgrx32,
+               .rowOrder = Rgb2Yuv::RowOrder::TopDown};
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "capture.hpp"
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <vector>
+
+// Grabs the root window with XShmGetImage into persistent shared memory
+// segments, so the X server writes BGRX rows straight into our address space.
+class ShmCapture final : public Capture
+{
+public:
+  static auto create(Display *display, int x, int y, int width, int height, int nBuffers)
+    -> std::unique_ptr<ShmCapture>;
+  ~ShmCapture() final;
+  auto grab(int buffer) -> std::optional<Frame> final;
+
+private:
+  struct Buffer
+  {
+    XImage *image;
+    XShmSegmentInfo shmInfo;
+  };
+
+  ShmCapture(Display *display, int x, int y);
+  auto addBuffer(int width, int height) -> bool;
+
+  Display *display;
+  int x;
+  int y;
+  std::vector<Buffer> buffers;
+};
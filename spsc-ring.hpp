@@ -0,0 +1,53 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <immintrin.h>
+#include <optional>
+
+// Bounded lock-free queue between exactly one producer and one consumer
+// thread. The consumer can block in pop(), which spins for a moment and then
+// sleeps on the tail index with atomic wait; push() only issues a wake-up
+// system call if the consumer is actually asleep.
+template <typename T, uint32_t N>
+class SpscRing
+{
+public:
+  auto tryPush(T v) -> bool
+  {
+    const auto t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == N)
+      return false;
+    items[t % N] = std::move(v);
+    tail.store(t + 1, std::memory_order_release);
+    tail.notify_one();
+    return true;
+  }
+
+  auto tryPop() -> std::optional<T>
+  {
+    const auto h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire))
+      return std::nullopt;
+    auto v = std::move(items[h % N]);
+    head.store(h + 1, std::memory_order_release);
+    return v;
+  }
+
+  auto pop() -> T
+  {
+    const auto h = head.load(std::memory_order_relaxed);
+    for (auto i = 0; i < 1024 && h == tail.load(std::memory_order_acquire); ++i)
+      _mm_pause();
+    for (auto t = tail.load(std::memory_order_acquire); t == h; t = tail.load(std::memory_order_acquire))
+      tail.wait(t, std::memory_order_acquire);
+    auto v = std::move(items[h % N]);
+    head.store(h + 1, std::memory_order_release);
+    return v;
+  }
+
+private:
+  std::array<T, N> items;
+  alignas(64) std::atomic<uint32_t> head = 0;
+  alignas(64) std::atomic<uint32_t> tail = 0;
+};
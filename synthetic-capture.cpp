@@ -0,0 +1,101 @@
+#include "synthetic-capture.hpp"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace
+{
+  constexpr auto SidebarWidth = 240; // screen columns left of the text, they do not scroll
+  constexpr auto LineHeight = 20;
+  constexpr auto GlyphHeight = 14;
+  constexpr auto CellWidth = 8;
+  constexpr auto ScrollSpeed = 4; // rows per frame
+
+  auto mix(uint64_t v) -> uint64_t
+  {
+    // splitmix64 finalizer
+    v = (v ^ (v >> 30)) * 0xbf58'476d'1ce4'e5b9;
+    v = (v ^ (v >> 27)) * 0x94d0'49bb'1331'11eb;
+    return v ^ (v >> 31);
+  }
+
+  // Screen pixel (sx, sy) of the desktop: a gradient sidebar and lines of
+  // glyph-like blocks on a light background, as B, G, R
+  auto desktopPixel(int sx, int sy, uint8_t *px) -> void
+  {
+    if (sx < SidebarWidth)
+    {
+      px[0] = static_cast<uint8_t>(120 + sy % 128);
+      px[1] = static_cast<uint8_t>(60 + sx / 4);
+      px[2] = 40;
+      return;
+    }
+
+    const auto line = sy / LineHeight;
+    const auto gy = sy % LineHeight;
+    const auto cell = (sx - SidebarWidth) / CellWidth;
+    const auto gx = (sx - SidebarWidth) % CellWidth;
+    const auto lineLength = 20 + static_cast<int>(mix(line) % 100);
+    auto isInk = false;
+    if (gy >= 2 && gy < 2 + GlyphHeight - 2 && gx >= 1 && gx < CellWidth - 1 && cell < lineLength)
+    {
+      const auto glyph = mix((static_cast<uint64_t>(line) << 32) + cell);
+      // Every seventh cell or so is a space between words
+      isInk = glyph % 7 != 0 && ((glyph >> (8 + (gy - 2) / 2 * 6 + gx - 1)) & 1);
+    }
+    const auto c = static_cast<uint8_t>(isInk ? 30 : 250);
+    px[0] = c;
+    px[1] = c;
+    px[2] = c;
+  }
+} // namespace
+
+SyntheticCapture::SyntheticCapture(std::string aPattern, int x, int y, int width, int height, int nBuffers)
+  : pattern(std::move(aPattern)), x(x), width(width), height(height), page(width * height * 2 * 4, 0xff)
+{
+  for (auto row = 0; row < 2 * height; ++row)
+    for (auto col = 0; col < width; ++col)
+      desktopPixel(x + col, y + row, &page[(row * width + col) * 4]);
+  for (auto i = 0; i < nBuffers; ++i)
+    buffers.emplace_back(width * height * 4, 0xff);
+}
+
+auto SyntheticCapture::grab(int buffer) -> std::optional<Frame>
+{
+  auto &pixels = buffers[buffer];
+  const auto lineSize = width * 4;
+  if (pattern == "noise")
+  {
+    // xorshift64, eight bytes at a time
+    for (auto i = size_t{0}; i + 8 <= pixels.size(); i += 8)
+    {
+      rng ^= rng << 13;
+      rng ^= rng >> 7;
+      rng ^= rng << 17;
+      memcpy(&pixels[i], &rng, 8);
+    }
+  }
+  else
+  {
+    const auto offset = pattern == "scroll" ? static_cast<int>(nFrames * ScrollSpeed % (2 * height)) : 0;
+    // The sidebar columns inside the capture area stay put
+    const auto sidebarBytes = std::clamp(SidebarWidth - x, 0, width) * 4;
+    for (auto row = 0; row < height; ++row)
+    {
+      const auto dst = &pixels[row * lineSize];
+      memcpy(dst, &page[row * lineSize], sidebarBytes);
+      const auto src = &page[(row + offset) % (2 * height) * lineSize];
+      memcpy(dst + sidebarBytes, src + sidebarBytes, lineSize - sidebarBytes);
+    }
+  }
+  ++nFrames;
+  return Frame{pixels.data(), lineSize, Rgb2Yuv::Format::Bgrx32, Rgb2Yuv::RowOrder::TopDown};
+}
+
+auto SyntheticCapture::poll() -> bool
+{
+  // A static screen only changes once, when it first appears
+  if (pattern != "static")
+    return true;
+  return !std::exchange(isPolled, true);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "capture.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Headless source that draws a test pattern into BGRX buffers:
+//   static - a desktop with text that never changes after the first frame
+//   scroll - the same desktop with its text scrolling up a few lines a second
+//   noise  - new random pixels every frame, the worst case for the encoder
+// The capture rectangle is cut from a synthetic screen of the configured size.
+class SyntheticCapture final : public Capture
+{
+public:
+  SyntheticCapture(std::string pattern, int x, int y, int width, int height, int nBuffers);
+  auto grab(int buffer) -> std::optional<Frame> final;
+  auto poll() -> bool final;
+
+private:
+  const std::string pattern;
+  const int x;
+  const int width;
+  const int height;
+  // Desktop of the capture area, twice its height so scrolling shows new
+  // lines for a while before it wraps around
+  std::vector<uint8_t> page;
+  std::vector<std::vector<uint8_t>> buffers;
+  int64_t nFrames = 0;
+  bool isPolled = false;
+  uint64_t rng = 0x9e37'79b9'7f4a'7c15;
+};
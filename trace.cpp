@@ -0,0 +1,148 @@
+#include "trace.hpp"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+namespace
+{
+  // Per thread; at 60 fps a few seconds of every span the pipeline records
+  constexpr auto RingSize = 32 * 1024;
+  // Rings of threads that ended are kept for the next dump, up to this many
+  constexpr auto MaxEndedRings = 32;
+
+  auto isTraceEnabled = std::atomic<bool>{false};
+
+  struct Event
+  {
+    const char *name;
+    int64_t begin; // ns on the steady clock
+    int64_t duration;
+    int64_t id;
+  };
+
+  // Written by its thread and read by a dump, which is rare, so an
+  // uncontended mutex is all the synchronization it needs
+  struct Ring
+  {
+    int tid;
+    std::mutex mutex;
+    std::string threadName;
+    std::vector<Event> events;
+    size_t next = 0;
+    bool isWrapped = false;
+    std::atomic<bool> isEnded = false;
+  };
+
+  auto registryMutex = std::mutex{};
+  auto rings = std::vector<std::shared_ptr<Ring>>{};
+  auto nextTid = 0;
+
+  struct ThreadRing
+  {
+    std::shared_ptr<Ring> ring;
+    ~ThreadRing()
+    {
+      if (ring)
+        ring->isEnded = true;
+    }
+  };
+
+  auto threadRing() -> Ring &
+  {
+    thread_local auto inst = ThreadRing{};
+    if (!inst.ring)
+    {
+      auto ring = std::make_shared<Ring>();
+      ring->events.resize(RingSize);
+      auto lock = std::unique_lock{registryMutex};
+      ring->tid = ++nextTid;
+      ring->threadName = "thread " + std::to_string(ring->tid);
+      // Sessions come and go with their threads; forget the oldest of them
+      if (std::count_if(std::begin(rings), std::end(rings), [](const auto &r) { return r->isEnded.load(); }) >=
+          MaxEndedRings)
+        rings.erase(std::find_if(std::begin(rings), std::end(rings), [](const auto &r) { return r->isEnded.load(); }));
+      rings.push_back(ring);
+      inst.ring = std::move(ring);
+    }
+    return *inst.ring;
+  }
+
+  auto toNs(Trace::Clock::time_point t) -> int64_t
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+  }
+} // namespace
+
+auto Trace::enable() -> void
+{
+  isTraceEnabled.store(true, std::memory_order_relaxed);
+}
+
+auto Trace::isEnabled() -> bool
+{
+  return isTraceEnabled.load(std::memory_order_relaxed);
+}
+
+auto Trace::setThreadName(const char *name) -> void
+{
+  if (!isEnabled())
+    return;
+  auto &ring = threadRing();
+  auto lock = std::unique_lock{ring.mutex};
+  ring.threadName = name;
+}
+
+auto Trace::complete(const char *name, Clock::time_point begin, Clock::time_point end, int64_t id) -> void
+{
+  if (!isEnabled())
+    return;
+  auto &ring = threadRing();
+  auto lock = std::unique_lock{ring.mutex};
+  ring.events[ring.next] = Event{.name = name, .begin = toNs(begin), .duration = toNs(end) - toNs(begin), .id = id};
+  if (++ring.next == ring.events.size())
+  {
+    ring.next = 0;
+    ring.isWrapped = true;
+  }
+}
+
+auto Trace::toJson() -> std::string
+{
+  auto lock = std::unique_lock{registryMutex};
+  const auto snapshot = rings;
+  lock.unlock();
+
+  auto os = std::ostringstream{};
+  os.precision(3);
+  os << std::fixed << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  auto isFirst = true;
+  const auto separator = [&]() -> std::ostream & {
+    if (!std::exchange(isFirst, false))
+      os << ",\n";
+    return os;
+  };
+  for (const auto &ring : snapshot)
+  {
+    auto ringLock = std::unique_lock{ring->mutex};
+    separator() << R"({"ph":"M","name":"thread_name","pid":1,"tid":)" << ring->tid << R"(,"args":{"name":")"
+                << ring->threadName << "\"}}";
+    const auto n = ring->isWrapped ? ring->events.size() : ring->next;
+    const auto first = ring->isWrapped ? ring->next : 0;
+    for (auto i = size_t{0}; i < n; ++i)
+    {
+      const auto &event = ring->events[(first + i) % ring->events.size()];
+      // Timestamps and durations are in microseconds
+      separator() << R"({"ph":"X","pid":1,"tid":)" << ring->tid << R"(,"name":")" << event.name << R"(","ts":)"
+                  << event.begin / 1000. << R"(,"dur":)" << event.duration / 1000.;
+      if (event.id >= 0)
+        os << R"(,"args":{"id":)" << event.id << '}';
+      os << '}';
+    }
+  }
+  os << "]}\n";
+  return os.str();
+}
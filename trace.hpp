@@ -0,0 +1,47 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Optional timeline tracer. Every thread records spans into its own ring
+// buffer of the most recent events; the rings are dumped in the Chrome trace
+// event format, which chrome://tracing and Perfetto open. When tracing is off
+// recording a span costs one relaxed load. Span names must be string literals.
+class Trace
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  static auto enable() -> void;
+  static auto isEnabled() -> bool;
+  // Shown as the thread's track in the viewer
+  static auto setThreadName(const char *name) -> void;
+  // A span that began and ended on this thread, or that only ended here, e.g.
+  // an asynchronous write. id is shown as the span's argument, e.g. a frame
+  // number; negative for none.
+  static auto complete(const char *name, Clock::time_point begin, Clock::time_point end, int64_t id = -1) -> void;
+  // The events of all threads as a JSON trace
+  static auto toJson() -> std::string;
+};
+
+// Records its own lifetime as a span
+class TraceSpan
+{
+public:
+  TraceSpan(const char *name, int64_t id = -1)
+    : name(name), id(id), begin(Trace::isEnabled() ? Trace::Clock::now() : Trace::Clock::time_point{})
+  {
+  }
+  ~TraceSpan()
+  {
+    if (begin != Trace::Clock::time_point{})
+      Trace::complete(name, begin, Trace::Clock::now(), id);
+  }
+  TraceSpan(const TraceSpan &) = delete;
+  auto operator=(const TraceSpan &) -> TraceSpan & = delete;
+
+private:
+  const char *name;
+  const int64_t id;
+  const Trace::Clock::time_point begin;
+};
@@ -0,0 +1,254 @@
+#include "video-encoder.hpp"
+#include "config.hpp"
+#include <algorithm>
+#include <cmath>
+#include <log/log.hpp>
+#include <utility>
+
+extern "C" {
+#include <libavutil/opt.h>
+}
+
+namespace
+{
+  auto setOpt(AVCodecContext *codecContext, const char *name, const std::string &value) -> void
+  {
+    if (av_opt_set(codecContext->priv_data, name, value.c_str(), 0) < 0)
+      LOG("Encoder option is not supported:", name, value);
+  }
+
+  // libvpx, libaom and SVT-AV1 quantize on a 0-63 scale
+  auto crfTo63(int crf) -> int
+  {
+    return std::clamp((crf * 63 + 25) / 51, 0, 63);
+  }
+
+  auto configureX264(AVCodecContext *codecContext, int crf, const char *profile, const char *params) -> void
+  {
+    setOpt(codecContext, "preset", "ultrafast");
+    setOpt(codecContext, "profile", profile);
+    setOpt(codecContext, "tune", "zerolatency");
+    setOpt(codecContext, "crf", std::to_string(crf));
+    // Frames marked AV_PICTURE_TYPE_I become IDR frames a new client can start from
+    setOpt(codecContext, "forced-idr", "1");
+    if (*params)
+      setOpt(codecContext, "x264-params", params);
+    if (config().intraRefresh)
+    {
+      // A column of intra macroblocks sweeps across the picture once per
+      // period, so there is no periodic IDR burst. Frames forced to
+      // AV_PICTURE_TYPE_I, for new or recovering clients, are still IDR.
+      setOpt(codecContext, "intra-refresh", "1");
+      codecContext->gop_size = config().fps; // one sweep a second at full rate
+    }
+  }
+
+  auto configureX264Baseline(AVCodecContext *codecContext, int crf) -> void
+  {
+    configureX264(codecContext, crf, "baseline", "");
+  }
+
+  // ultrafast turns CABAC off; it costs little CPU and saves a good share of
+  // the bitrate, which is the point of picking main or high
+  auto configureX264Main(AVCodecContext *codecContext, int crf) -> void
+  {
+    configureX264(codecContext, crf, "main", "cabac=1");
+  }
+
+  auto configureX264High(AVCodecContext *codecContext, int crf) -> void
+  {
+    configureX264(codecContext, crf, "high", "cabac=1:8x8dct=1");
+  }
+
+  auto configureOpenH264(AVCodecContext *codecContext, int crf) -> void
+  {
+    // No constant quality mode: aim at the bitrate x264 would need for this CRF
+    codecContext->bit_rate = VideoEncoder::estimateBitrate(*VideoEncoder::find("h264-baseline"), crf);
+    setOpt(codecContext, "rc_mode", "bitrate");
+    setOpt(codecContext, "allow_skip_frames", "0");
+  }
+
+  auto configureVp8(AVCodecContext *codecContext, int crf) -> void
+  {
+    setOpt(codecContext, "deadline", "realtime");
+    setOpt(codecContext, "cpu-used", "16");
+    setOpt(codecContext, "lag-in-frames", "0");
+    setOpt(codecContext, "crf", std::to_string(crfTo63(crf)));
+    // VP8 only has constrained quality, the bitrate is a ceiling
+    codecContext->bit_rate = 4 * VideoEncoder::estimateBitrate(*VideoEncoder::find("vp8"), crf);
+  }
+
+  auto configureVp9(AVCodecContext *codecContext, int crf) -> void
+  {
+    setOpt(codecContext, "deadline", "realtime");
+    setOpt(codecContext, "cpu-used", "8");
+    setOpt(codecContext, "lag-in-frames", "0");
+    setOpt(codecContext, "row-mt", "1");
+    setOpt(codecContext, "tile-columns", "2");
+    setOpt(codecContext, "crf", std::to_string(crfTo63(crf)));
+  }
+
+  auto configureSvtAv1(AVCodecContext *codecContext, int crf) -> void
+  {
+    setOpt(codecContext, "preset", "8");
+    setOpt(codecContext, "la_depth", "0");
+    setOpt(codecContext, "rc", "cqp");
+    setOpt(codecContext, "qp", std::to_string(crfTo63(crf)));
+  }
+
+  auto configureAom(AVCodecContext *codecContext, int crf) -> void
+  {
+    setOpt(codecContext, "usage", "realtime");
+    setOpt(codecContext, "cpu-used", "8");
+    setOpt(codecContext, "lag-in-frames", "0");
+    setOpt(codecContext, "row-mt", "1");
+    setOpt(codecContext, "crf", std::to_string(crfTo63(crf)));
+  }
+} // namespace
+
+auto VideoEncoder::backends() -> const std::vector<Backend> &
+{
+  // Codec strings name the highest level we may produce (5.1, 4K at 60 fps);
+  // the encoders pick the actual level from the frame size
+  static const auto inst = std::vector<Backend>{
+    {"h264-baseline", "libx264", "avc1.42E033", 1.0f, 0.060f, true, "baseline", configureX264Baseline},
+    {"h264-main", "libx264", "avc1.4D0033", 1.1f, 0.052f, true, "main", configureX264Main},
+    {"h264-high", "libx264", "avc1.640033", 1.2f, 0.048f, true, "high", configureX264High},
+    {"h264-openh264", "libopenh264", "avc1.42E033", 1.3f, 0.065f, false, nullptr, configureOpenH264},
+    {"vp8", "libvpx", "vp8", 2.0f, 0.058f, false, nullptr, configureVp8},
+    {"vp9", "libvpx-vp9", "vp09.00.51.08", 3.0f, 0.038f, false, nullptr, configureVp9},
+    {"av1-svt", "libsvtav1", "av01.0.13M.08", 4.0f, 0.032f, false, nullptr, configureSvtAv1},
+    {"av1-aom", "libaom-av1", "av01.0.13M.08", 6.0f, 0.030f, false, nullptr, configureAom},
+  };
+  return inst;
+}
+
+auto VideoEncoder::find(const std::string &name) -> const Backend *
+{
+  const auto &all = backends();
+  const auto it = std::find_if(std::begin(all), std::end(all), [&](const auto &b) { return b.name == name; });
+  return it != std::end(all) ? &*it : nullptr;
+}
+
+auto VideoEncoder::available() -> std::vector<const Backend *>
+{
+  auto ret = std::vector<const Backend *>{};
+  const auto &allowed = config().codecs;
+  for (const auto &backend : backends())
+    if ((allowed.empty() || std::find(std::begin(allowed), std::end(allowed), backend.name) != std::end(allowed)) &&
+        avcodec_find_encoder_by_name(backend.encoder))
+      ret.push_back(&backend);
+  return ret;
+}
+
+auto VideoEncoder::negotiate(const std::vector<std::string> &clientCodecs) -> const Backend *
+{
+  auto candidates = available();
+  std::erase_if(candidates, [&](const auto backend) {
+    return std::find(std::begin(clientCodecs), std::end(clientCodecs), backend->name) == std::end(clientCodecs);
+  });
+  if (candidates.empty())
+    return nullptr;
+
+  const auto target = int64_t{config().videoBitrate} * 1000;
+  if (target == 0)
+    return candidates.front();
+  for (const auto backend : candidates)
+    if (estimateBitrate(*backend, config().crf) <= target)
+      return backend;
+  return *std::min_element(std::begin(candidates), std::end(candidates), [](const auto a, const auto b) {
+    return a->bitsPerPixel < b->bitsPerPixel;
+  });
+}
+
+auto VideoEncoder::estimateBitrate(const Backend &backend, int crf) -> int64_t
+{
+  // Every 6 CRF steps halve the bitrate
+  return static_cast<int64_t>(backend.bitsPerPixel * config().width * config().height * config().fps *
+                              std::exp2((34 - crf) / 6.0));
+}
+
+VideoEncoder::VideoEncoder(const Backend &backend, int width, int height, int crf)
+  : backend(backend), width(width), height(height), crf(crf)
+{
+  open();
+}
+
+VideoEncoder::~VideoEncoder()
+{
+  close();
+}
+
+auto VideoEncoder::open() -> void
+{
+  LOG("Initialize", backend.name, "encoder, CRF", crf);
+
+  const auto codec = avcodec_find_encoder_by_name(backend.encoder);
+  if (!codec)
+  {
+    LOG("Codec not found:", backend.encoder);
+    exit(1);
+  }
+
+  codecContext = avcodec_alloc_context3(codec);
+  if (!codecContext)
+  {
+    LOG("Could not allocate video codec context");
+    exit(1);
+  }
+
+  codecContext->bit_rate = 0;
+  codecContext->width = width;
+  codecContext->height = height;
+  // PTS are capture times in microseconds
+  codecContext->time_base = {1, 1'000'000};
+  codecContext->framerate = {config().fps, 1};
+  codecContext->gop_size = 2000;
+  codecContext->max_b_frames = 0;
+  codecContext->pix_fmt = AV_PIX_FMT_YUV420P;
+
+  codecContext->flags |= AV_CODEC_FLAG_LOW_DELAY;
+  codecContext->thread_count = 0;
+
+  backend.configure(codecContext, crf);
+
+  if (avcodec_open2(codecContext, codec, nullptr) < 0)
+  {
+    LOG("Could not open codec");
+    exit(1);
+  }
+}
+
+auto VideoEncoder::close() -> void
+{
+  avcodec_free_context(&codecContext);
+}
+
+auto VideoEncoder::setCrf(int value) -> void
+{
+  if (value == crf)
+    return;
+  crf = value;
+  if (backend.canRetune)
+  {
+    // libx264 picks up a changed crf option and calls x264_encoder_reconfig()
+    // before encoding the frame
+    setOpt(codecContext, "crf", std::to_string(crf));
+    return;
+  }
+  close();
+  open();
+  isReopened = true;
+}
+
+auto VideoEncoder::send(AVFrame *frame, bool isKeyframe) -> int
+{
+  const auto isFirstAfterReopen = std::exchange(isReopened, false);
+  frame->pict_type = isKeyframe || isFirstAfterReopen ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+  return avcodec_send_frame(codecContext, frame);
+}
+
+auto VideoEncoder::receive(AVPacket *pkt) -> int
+{
+  return avcodec_receive_packet(codecContext, pkt);
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+// Software video encoder reached through libavcodec. The backends differ in
+// the libavcodec encoder, its low latency options and how CRF maps onto its
+// quality scale; the pipeline only sees frames in and packets out.
+class VideoEncoder
+{
+public:
+  struct Backend
+  {
+    const char *name;     // used on the command line and in codec negotiation
+    const char *encoder;  // libavcodec encoder name
+    const char *webCodec; // WebCodecs codec string the client checks and decodes with
+    float cost;           // encode CPU time relative to h264-baseline
+    float bitsPerPixel;   // rough bitrate on desktop content at CRF 34
+    bool canRetune;       // CRF changes apply without reopening the encoder
+    const char *x264Profile; // profile for the native sliced x264 path, nullptr if not x264
+    auto (*configure)(AVCodecContext *codecContext, int crf) -> void;
+  };
+
+  // All backends in order of increasing cost
+  static auto backends() -> const std::vector<Backend> &;
+  static auto find(const std::string &name) -> const Backend *;
+  // Backends allowed by the config and compiled into libavcodec
+  static auto available() -> std::vector<const Backend *>;
+  // Picks the cheapest of the backends the client can decode whose estimated
+  // bitrate meets the configured target, or the most efficient one if none
+  // does. Returns nullptr if there is nothing in common.
+  static auto negotiate(const std::vector<std::string> &clientCodecs) -> const Backend *;
+  // Rough estimate in bits per second at the configured output size and frame rate
+  static auto estimateBitrate(const Backend &backend, int crf) -> int64_t;
+
+  VideoEncoder(const Backend &backend, int width, int height, int crf);
+  ~VideoEncoder();
+
+  // Takes effect on the next frame; backends that cannot retune are reopened
+  // and start over with a keyframe
+  auto setCrf(int crf) -> void;
+  // The frame's pts is in microseconds
+  auto send(AVFrame *frame, bool isKeyframe) -> int;
+  // Same return values as avcodec_receive_packet()
+  auto receive(AVPacket *pkt) -> int;
+
+private:
+  auto open() -> void;
+  auto close() -> void;
+
+  const Backend &backend;
+  const int width;
+  const int height;
+  int crf;
+  AVCodecContext *codecContext = nullptr;
+  bool isReopened = false;
+};
@@ -0,0 +1,341 @@
+#include "video-pipeline.hpp"
+#include "config.hpp"
+#include "frame-scheduler.hpp"
+#include "rgb2yuv.hpp"
+#include "trace.hpp"
+#include "worker-pool.hpp"
+#include <log/log.hpp>
+
+VideoPipeline::VideoPipeline(Clock::time_point startTime,
+                             StreamMetrics &metrics,
+                             const VideoEncoder::Backend &backend,
+                             int x,
+                             int y,
+                             int captureWidth,
+                             int captureHeight,
+                             int width,
+                             int height,
+                             OnPacket onPacket)
+  : x(x),
+    y(y),
+    captureWidth(captureWidth),
+    captureHeight(captureHeight),
+    width(width),
+    height(height),
+    onPacket(std::move(onPacket)),
+    metrics(metrics),
+    targetCrf(config().crf),
+    targetFps(config().fps),
+    startTime(startTime)
+{
+  if (config().sliceSize > 0 && backend.x264Profile)
+    sliceEncoder = std::make_unique<X264SliceEncoder>(
+      backend.x264Profile, width, height, config().crf, config().sliceSize, [this](AVPacket *pkt, bool isFrameEnd) {
+        if (this->onPacket(pkt, isFrameEnd))
+          isKeyframeRequested = true;
+      });
+  else
+  {
+    if (config().sliceSize > 0)
+      LOG("Sliced encoding needs an x264 codec,", backend.name, "sends whole frames");
+    encoder = std::make_unique<VideoEncoder>(backend, width, height, config().crf);
+  }
+  initFrames();
+  for (auto i = 0; i < NSlots; ++i)
+    freeSlots.tryPush(i);
+
+  captureThread = std::thread{[this]() { captureThreadFunc(); }};
+  convertThread = std::thread{[this]() { convertThreadFunc(); }};
+  encodeThread = std::thread{[this]() { encodeThreadFunc(); }};
+}
+
+VideoPipeline::~VideoPipeline()
+{
+  isRunning = false;
+  // The capture thread notices the flag on its next tick and sends the
+  // shutdown marker down the pipeline
+  captureThread.join();
+  convertThread.join();
+  encodeThread.join();
+
+  for (auto &slot : slots)
+    av_frame_free(&slot.frame);
+  av_packet_free(&pkt);
+  encoder.reset();
+  sliceEncoder.reset();
+}
+
+auto VideoPipeline::requestKeyframe() -> void
+{
+  isKeyframeRequested = true;
+}
+
+auto VideoPipeline::setRate(int crf, int fps) -> void
+{
+  targetCrf = crf;
+  targetFps = fps;
+}
+
+auto VideoPipeline::initFrames() -> void
+{
+  pkt = av_packet_alloc();
+  if (!pkt)
+  {
+    LOG("Could not allocate AVPacket");
+    exit(1);
+  }
+
+  for (auto &slot : slots)
+  {
+    slot.frame = av_frame_alloc();
+    if (!slot.frame)
+    {
+      LOG("Could not allocate video frame");
+      exit(1);
+    }
+    slot.frame->format = AV_PIX_FMT_YUV420P;
+    slot.frame->width = width;
+    slot.frame->height = height;
+
+    if (const auto ret = av_frame_get_buffer(slot.frame, 32); ret < 0)
+    {
+      LOG("Could not allocate the video frame data");
+      exit(1);
+    }
+  }
+}
+
+auto VideoPipeline::captureThreadFunc() -> void
+{
+  Trace::setThreadName("capture");
+  auto capture = makeCapture(x, y, captureWidth, captureHeight, NSlots);
+  if (!capture)
+  {
+    LOG("Cannot initialize capture");
+    isRunning = false;
+    toConvert.tryPush(-1);
+    return;
+  }
+
+  auto isFirstFrame = true;
+  // Ticks in a row with nothing to send; after half a second of them the loop
+  // waits for damage at the idle rate
+  auto nUnchanged = 0;
+
+  auto scheduler =
+    FrameScheduler{targetFps, config().idleFps, std::chrono::microseconds{config().pacingSpin}};
+  // Benchmarks run as fast as the slowest stage allows, waiting for slots
+  // instead of deadlines
+  const auto isUnpaced = config().bench > 0;
+  // Kept across ticks with nothing to grab; only the encode thread pushes to
+  // freeSlots, which allows a single producer
+  auto slotIdx = std::optional<int>{};
+  // Ticks skipped because the pipeline was full, logged at most once a second;
+  // with an encoder slower than the capture rate that is every other tick
+  auto nFullTicks = 0;
+  auto fullLoggedAt = Clock::now();
+  while (isRunning)
+  {
+    scheduler.setFps(targetFps);
+    if (!slotIdx)
+      slotIdx = isUnpaced ? std::optional{freeSlots.pop()} : freeSlots.tryPop();
+    const auto t1 = Clock::now();
+    if (!slotIdx)
+    {
+      // Convert or encode is behind and holds every slot. Changes stay
+      // pending in the capture source, so nothing is lost by skipping this tick.
+      ++nFullTicks;
+      if (t1 - fullLoggedAt >= std::chrono::seconds{1})
+      {
+        LOG("Frame delayed, pipeline is full,", nFullTicks, "ticks skipped");
+        nFullTicks = 0;
+        fullLoggedAt = t1;
+      }
+      scheduler.wait();
+      continue;
+    }
+    auto &slot = slots[*slotIdx];
+
+    const auto isDamaged = capture->poll();
+    const auto isKeyframe = isKeyframeRequested.exchange(false);
+    if (!isDamaged && !isFirstFrame && !isKeyframe)
+    {
+      // Nothing changed on screen: skip grab, color conversion and encoding
+      if (++nUnchanged >= targetFps / 2)
+        capture->waitIdle(scheduler);
+      else
+        scheduler.wait();
+      continue;
+    }
+    isFirstFrame = false;
+    nUnchanged = 0;
+
+    // Real capture times, so a frame after an idle period or a late one
+    // carries its actual timing
+    const auto pts = std::chrono::duration_cast<std::chrono::microseconds>(t1 - startTime).count();
+    const auto grabStart = Clock::now();
+    const auto captured = capture->grab(*slotIdx);
+    if (!captured)
+      break;
+
+    const auto t2 = Clock::now();
+    Trace::complete("grab", grabStart, t2, pts);
+    slot.captured = *captured;
+    slot.isKeyframe = isKeyframe;
+    slot.pts = pts;
+    slot.tickTime = t1;
+    slot.grabbedTime = t2;
+    toConvert.tryPush(*slotIdx);
+    slotIdx.reset();
+
+    if (isUnpaced)
+      continue;
+    if (const auto missed = scheduler.wait(); missed > 0)
+      LOG("Frame delayed, missed",
+          missed,
+          "deadlines, grab",
+          std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(t2 - t1));
+  }
+
+  isRunning = false;
+  toConvert.tryPush(-1);
+  // The capture buffers belong to the backend: wait until the later stages
+  // hand every slot back before destroying it
+  for (auto i = slotIdx ? 1 : 0; i < NSlots; ++i)
+    freeSlots.pop();
+  capture.reset();
+
+  LOG("Capture thread ended");
+}
+
+auto VideoPipeline::convertThreadFunc() -> void
+{
+  Trace::setThreadName("convert");
+  auto rgb2yuv =
+    Rgb2Yuv{WorkerPool::shared(), captureWidth, captureHeight, width, height, config().rgb2yuvKernel};
+  for (;;)
+  {
+    const auto slotIdx = toConvert.pop();
+    if (slotIdx < 0)
+      break;
+    auto &slot = slots[slotIdx];
+    const auto span = TraceSpan{"convert", slot.pts};
+    slot.convStartTime = Clock::now();
+
+    // The encoder may still reference the previous picture of this slot
+    if (av_frame_make_writable(slot.frame) < 0)
+    {
+      LOG("Could not make the video frame writable");
+      isRunning = false;
+      toEncode.tryPush(slotIdx);
+      continue;
+    }
+    rgb2yuv.convert(slot.captured.pixels,
+                    slot.captured.lineSize,
+                    slot.captured.format,
+                    slot.captured.rowOrder,
+                    slot.frame->data,
+                    slot.frame->linesize);
+
+    slot.convertedTime = Clock::now();
+    toEncode.tryPush(slotIdx);
+  }
+  toEncode.tryPush(-1);
+  LOG("Convert thread ended");
+}
+
+auto VideoPipeline::encodeThreadFunc() -> void
+{
+  Trace::setThreadName("encode");
+  for (;;)
+  {
+    const auto slotIdx = toEncode.pop();
+    if (slotIdx < 0)
+      break;
+    // After a failure keep draining slots so the capture thread can shut down
+    if (isRunning && encode(slots[slotIdx]) < 0)
+    {
+      LOG("Error encoding frame");
+      isRunning = false;
+    }
+    freeSlots.tryPush(slotIdx);
+  }
+  LOG("Encode thread ended");
+}
+
+auto VideoPipeline::encode(Slot &slot) -> int
+{
+  const auto span = TraceSpan{"encode", slot.pts};
+  const auto t5 = Clock::now();
+  slot.frame->pts = slot.pts;
+  // Once per GOP, like the keyframes that used to trigger it
+  if (slot.isKeyframe || benchCnt >= 2000)
+    logBenchmark();
+  if (sliceEncoder)
+  {
+    // Slices go out from inside encode()
+    sliceEncoder->setCrf(targetCrf);
+    if (sliceEncoder->encode(slot.frame, slot.isKeyframe) < 0)
+    {
+      LOG("Error during encoding");
+      return -1;
+    }
+  }
+  else
+  {
+    encoder->setCrf(targetCrf);
+    auto ret = encoder->send(slot.frame, slot.isKeyframe);
+    if (ret < 0)
+    {
+      LOG("Error sending a frame for encoding");
+      return ret;
+    }
+
+    while (ret >= 0)
+    {
+      ret = encoder->receive(pkt);
+      if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+        break;
+      else if (ret < 0)
+      {
+        LOG("Error during encoding");
+        return ret;
+      }
+      if (onPacket(pkt, true))
+        isKeyframeRequested = true;
+      av_packet_unref(pkt);
+    }
+  }
+  const auto t6 = Clock::now();
+  const auto toUs = [](auto d) { return std::chrono::duration_cast<std::chrono::microseconds>(d).count(); };
+  metrics.capture.record(toUs(slot.grabbedTime - slot.tickTime));
+  metrics.convert.record(toUs(slot.convertedTime - slot.convStartTime));
+  metrics.encode.record(toUs(t6 - t5));
+  grabAcc += slot.grabbedTime - slot.tickTime;
+  colorConvAcc += slot.convertedTime - slot.convStartTime;
+  encAcc += t6 - t5;
+  latencyAcc += t6 - slot.tickTime;
+  ++benchCnt;
+  return 0;
+}
+
+auto VideoPipeline::logBenchmark() -> void
+{
+  if (benchCnt == 0)
+    return;
+  LOG("Benchmark cnt",
+      benchCnt,
+      "grab",
+      std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(grabAcc / benchCnt),
+      "colorConv",
+      std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(colorConvAcc / benchCnt),
+      "enc",
+      std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(encAcc / benchCnt),
+      "latency",
+      std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(latencyAcc / benchCnt));
+  grabAcc = {};
+  colorConvAcc = {};
+  encAcc = {};
+  latencyAcc = {};
+  benchCnt = 0;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include "capture.hpp"
+#include "metrics.hpp"
+#include "spsc-ring.hpp"
+#include "video-encoder.hpp"
+#include "x264-slice-encoder.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+// Captures, color converts and encodes the screen on three threads, so frame
+// N+1 is grabbed while frame N is converted and frame N-1 is encoded. The
+// stages hand a small ring of slots to each other through lock-free queues;
+// each slot owns one capture buffer and one AVFrame. When every slot is busy
+// the capture stage skips its tick, so throughput is bounded by the slowest
+// stage instead of the sum of all of them.
+class VideoPipeline
+{
+public:
+  // Called on the encode thread for every packet, or from x264's slice threads
+  // for every slice in sliced mode; isFrameEnd marks the last packet of a
+  // frame. Returning true asks for a keyframe as soon as possible, e.g.
+  // because a client had to drop frames.
+  using OnPacket = std::function<bool(AVPacket *pkt, bool isFrameEnd)>;
+
+  // Captures the captureWidth x captureHeight area at (x, y) and encodes it
+  // scaled to width x height. Packet PTS are microseconds since startTime.
+  VideoPipeline(std::chrono::steady_clock::time_point startTime,
+                StreamMetrics &metrics,
+                const VideoEncoder::Backend &backend,
+                int x,
+                int y,
+                int captureWidth,
+                int captureHeight,
+                int width,
+                int height,
+                OnPacket onPacket);
+  ~VideoPipeline();
+
+  // The next captured frame is encoded as an IDR frame even if the screen did
+  // not change
+  auto requestKeyframe() -> void;
+  // Retunes the encoder on the next frame and paces the capture at the given rate
+  auto setRate(int crf, int fps) -> void;
+
+private:
+  using Clock = std::chrono::steady_clock;
+  static constexpr int NSlots = 3;
+  struct Slot
+  {
+    Capture::Frame captured;
+    bool isKeyframe = false;
+    int64_t pts = 0; // microseconds since startTime, also the frame's trace id
+    AVFrame *frame = nullptr;
+    Clock::time_point tickTime;
+    Clock::time_point grabbedTime;
+    Clock::time_point convStartTime;
+    Clock::time_point convertedTime;
+  };
+  // Slot indices; -1 tells the next stage to shut down
+  using SlotQueue = SpscRing<int, NSlots + 1>;
+
+  auto captureThreadFunc() -> void;
+  auto convertThreadFunc() -> void;
+  auto encodeThreadFunc() -> void;
+  auto encode(Slot &slot) -> int;
+  // Logs and resets the stage timings averaged since the previous call
+  auto logBenchmark() -> void;
+  auto initFrames() -> void;
+
+  const int x;
+  const int y;
+  const int captureWidth;
+  const int captureHeight;
+  const int width;
+  const int height;
+  OnPacket onPacket;
+  StreamMetrics &metrics;
+  // One of the two is set; the sliced encoder when --slice-size is given for x264
+  std::unique_ptr<VideoEncoder> encoder;
+  std::unique_ptr<X264SliceEncoder> sliceEncoder;
+  AVPacket *pkt = nullptr; // reused for every frame, receivers move the data out
+  std::array<Slot, NSlots> slots;
+  SlotQueue freeSlots;
+  SlotQueue toConvert;
+  SlotQueue toEncode;
+  std::atomic<bool> isRunning = true;
+  std::atomic<bool> isKeyframeRequested = false;
+  std::atomic<int> targetCrf;
+  std::atomic<int> targetFps;
+  const Clock::time_point startTime; // PTS zero, shared with the audio of the stream
+  decltype(Clock::now() - Clock::now()) grabAcc = {};
+  decltype(Clock::now() - Clock::now()) colorConvAcc = {};
+  decltype(Clock::now() - Clock::now()) encAcc = {};
+  decltype(Clock::now() - Clock::now()) latencyAcc = {};
+  int benchCnt = 0;
+  std::thread captureThread;
+  std::thread convertThread;
+  std::thread encodeThread;
+};
@@ -1,452 +1,399 @@
 #include "web-socket-session.hpp"
-#include "rgb2yuv.hpp"
-#include <GL/gl.h>
-#include <GL/glx.h>
+#include "config.hpp"
+#include "media-header.hpp"
+#include "trace.hpp"
 #include <X11/Xutil.h>
 #include <X11/extensions/XTest.h>
-#include <X11/extensions/Xfixes.h>
 #include <json-ser/json-ser.hpp>
-#include <pulse/error.h>
-#include <pulse/simple.h>
 #include <ser/macro.hpp>
-#include <sys/ipc.h>
-#include <sys/shm.h>
+#include <utility>
 
-WebSocketSession::WebSocketSession(tcp::socket socket) : ws(std::move(socket))
+namespace
 {
-  initEncoder();
-  initAudio();
+  // Opening a display or starting a capture and encoder pipeline blocks for
+  // long enough to stall every session sharing an I/O thread, so it runs here
+  // and the result is handed back to the session's strand
+  auto setupPool() -> boost::asio::thread_pool &
+  {
+    static auto pool = boost::asio::thread_pool{2};
+    return pool;
+  }
 
-  display = XOpenDisplay(NULL);
-  if (!display)
+  // Dropping the last reference to a pipeline joins its threads, and closing
+  // a display waits for the X server
+  auto releaseOffIoThread(std::shared_ptr<Broadcast> source, Display *display = nullptr) -> void
   {
-    LOG("Cannot open display");
-    // Handle error appropriately
+    if (!source && !display)
+      return;
+    boost::asio::post(setupPool(), [source = std::move(source), display]() {
+      if (display)
+        XCloseDisplay(display);
+    });
   }
-}
+} // namespace
+
+WebSocketSession::WebSocketSession(tcp::socket socket) : ws(std::move(socket)), pingTimer(ws.get_executor()) {}
 
 WebSocketSession::~WebSocketSession()
 {
   LOG("Destructor initiated");
   isRunning = false;
+  // The pipeline threads call into this session until it is unsubscribed, so
+  // that cannot wait; it only contends with a fan-out of queue pushes
+  if (source)
+    source->unsubscribe(this);
+  releaseOffIoThread(std::move(source), std::exchange(display, nullptr));
+
+  LOG("Destructor finished");
+}
 
-  if (opusEncoder)
+auto WebSocketSession::run(http::request<http::string_body> req) -> void
+{
+  LOG("Accept the WebSocket handshake");
+  // The response is built before async_accept returns, req need not outlive it
+  ws.async_accept(req, boost::beast::bind_front_handler(&WebSocketSession::onAccept, shared_from_this()));
+}
+
+auto WebSocketSession::onAccept(boost::system::error_code ec) -> void
+{
+  if (ec)
   {
-    opus_encoder_destroy(opusEncoder);
-    opusEncoder = nullptr;
+    LOG("WebSocket handshake failed:", ec.message());
+    return;
   }
+  boost::asio::post(setupPool(), [self = shared_from_this()]() {
+    const auto display = XOpenDisplay(nullptr);
+    if (!display)
+      LOG("Cannot open display, input is ignored");
+    boost::asio::post(self->ws.get_executor(), [self, display]() { self->display = display; });
+  });
+
+  // Frames start once the client told which codecs it can decode
+  sendConfig();
+  ws.control_callback([this](websocket::frame_type kind, boost::beast::string_view) { onControl(kind); });
+  doRead();
+  doPing();
+}
 
-  if (paStream)
+namespace
+{
+  struct CodecInfo
   {
-    pa_simple_free(paStream);
-    paStream = nullptr;
-  }
+    std::string name;
+    std::string codec; // WebCodecs codec string
+    SER_PROPS(name, codec);
+  };
 
-  if (codecContext)
+  struct StreamConfig
   {
-    avcodec_free_context(&codecContext);
-    codecContext = nullptr;
-  }
-  if (frame)
+    std::string type = "config";
+    int width;
+    int height;
+    // Cursor positions and shapes are in capture pixels
+    int captureWidth;
+    int captureHeight;
+    // The client answers with the ones it can decode
+    std::vector<CodecInfo> codecs;
+    SER_PROPS(type, width, height, captureWidth, captureHeight, codecs);
+  };
+
+  struct StreamCodec
   {
-    av_frame_free(&frame);
-    frame = nullptr;
-  }
+    std::string type = "codec";
+    std::string name;
+    std::string codec;
+    SER_PROPS(type, name, codec);
+  };
 
-  if (display)
+  // The client answers right away with its own clock added
+  struct ClockProbe
   {
-    XCloseDisplay(display);
-    display = nullptr;
-  }
+    std::string type = "clock";
+    int64_t serverTime;
+    SER_PROPS(type, serverTime);
+  };
+} // namespace
 
-  LOG("Destructor finished");
+auto WebSocketSession::sendConfig() -> void
+{
+  // Queued before anything else, so it is the first message the client reads
+  auto ss = std::ostringstream{};
+  const auto &c = config();
+  auto msg = StreamConfig{.width = c.width,
+                          .height = c.height,
+                          .captureWidth = c.captureWidth,
+                          .captureHeight = c.captureHeight,
+                          .codecs = {}};
+  for (const auto backend : VideoEncoder::available())
+    msg.codecs.push_back(CodecInfo{.name = backend->name, .codec = backend->webCodec});
+  jsonSer(ss, msg);
+  sendControl(ss.str());
 }
 
-auto WebSocketSession::run(http::request<http::string_body> req) -> void
+auto WebSocketSession::sendControl(const std::string &json) -> void
 {
-  LOG("Accept the WebSocket handshake");
-  ws.accept(req);
-
-  doRead();
+  auto message = Message::acquire();
+  message->setType(0x03); // JSON control message identifier
+  if (std::ssize(json) > Message::InlineCapacity)
+  {
+    LOG("Control message is too large");
+    return;
+  }
+  std::copy(std::begin(json), std::end(json), message->inlineData());
+  message->setInlineSize(json.size());
 
-  LOG("Start sending frames");
-  startSendingFrames();
+  auto lock = std::unique_lock{queueMutex};
+  if (!isRunning)
+    return;
+  controlQueue.push_back(std::move(message));
+  startWriting();
 }
 
-auto WebSocketSession::initEncoder() -> void
+auto WebSocketSession::sendClockProbe() -> void
 {
-  LOG("Initialize FFmpeg encoder");
+  auto ss = std::ostringstream{};
+  jsonSer(ss, ClockProbe{.serverTime = LatencyProbe::now()});
+  sendControl(ss.str());
+}
 
-  // codec = avcodec_find_encoder_by_name("h264_nvenc");
-  codec = avcodec_find_encoder(AV_CODEC_ID_H264);
-  if (!codec)
-  {
-    LOG("Codec not found");
-    exit(1);
-  }
+auto WebSocketSession::startSendingFrames(const VideoEncoder::Backend &backend) -> void
+{
+  LOG("Start sending", backend.name, "frames");
+  auto ss = std::ostringstream{};
+  jsonSer(ss, StreamCodec{.name = backend.name, .codec = backend.webCodec});
+  sendControl(ss.str());
+  isNegotiated = true;
+  boost::asio::post(setupPool(), [self = shared_from_this(), &backend]() {
+    auto source = config().broadcast ? Broadcast::shared(backend) : std::make_shared<Broadcast>(backend);
+    boost::asio::post(self->ws.get_executor(), [self, source = std::move(source)]() mutable {
+      if (!self->isRunning)
+      {
+        releaseOffIoThread(std::move(source));
+        return;
+      }
+      self->source = std::move(source);
+      self->source->subscribe(self.get());
+    });
+  });
+}
 
-  codecContext = avcodec_alloc_context3(codec);
-  if (!codecContext)
+auto WebSocketSession::sendVideo(const MessageRef &message, bool isKeyframe, bool isFrameStart) -> bool
+{
+  auto lock = std::unique_lock{queueMutex};
+  if (!isRunning)
+    return false;
+  if (!isFrameStart)
   {
-    LOG("Could not allocate video codec context");
-    exit(1);
+    // The rest of a sliced frame follows its first part or is dropped with it
+    if (isWaitingForKeyframe)
+      return false;
   }
-
-  codecContext->bit_rate = 0;
-  codecContext->width = width;
-  codecContext->height = height;
-  codecContext->time_base = {1, 60};
-  codecContext->framerate = {60, 1};
-  codecContext->gop_size = 2000;
-  codecContext->max_b_frames = 0;
-  codecContext->pix_fmt = AV_PIX_FMT_YUV420P;
-
-  codecContext->flags |= AV_CODEC_FLAG_LOW_DELAY;
-  codecContext->thread_count = 0;
-
-  av_opt_set(codecContext->priv_data, "preset", "ultrafast", 0);
-  av_opt_set(codecContext->priv_data, "profile", "baseline", 0);
-  av_opt_set(codecContext->priv_data, "tune", "zerolatency", 0);
-  av_opt_set(codecContext->priv_data, "crf", "34", 0);
-
-  if (avcodec_open2(codecContext, codec, nullptr) < 0)
+  else if (isKeyframe)
   {
-    LOG("Could not open codec");
-    exit(1);
+    // Video queued before a keyframe is stale, the client can start over from it
+    videoQueue.clear();
+    isWaitingForKeyframe = false;
   }
-
-  frame = av_frame_alloc();
-  if (!frame)
+  else if (isWaitingForKeyframe)
   {
-    LOG("Could not allocate video frame");
-    exit(1);
+    metrics->nFramesDropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
   }
-  frame->format = codecContext->pix_fmt;
-  frame->width = codecContext->width;
-  frame->height = codecContext->height;
-
-  if (const auto ret = av_frame_get_buffer(frame, 32); ret < 0)
+  else if (queuedFrames() >= MaxQueuedVideo)
   {
-    LOG("Could not allocate the video frame data");
-    exit(1);
+    // Every P-frame references the previous one, so once one is dropped the
+    // rest are undecodable until the next keyframe
+    LOG("Client is too slow, drop video until the next keyframe");
+    metrics->nFramesDropped.fetch_add(queuedFrames() + 1, std::memory_order_relaxed);
+    videoQueue.clear();
+    isWaitingForKeyframe = true;
+    ++nDrops;
+    return true;
   }
+  videoQueue.push_back(
+    QueuedVideo{.message = message, .isFrameStart = isFrameStart, .queuedAt = std::chrono::steady_clock::now()});
+  startWriting();
+  return false;
 }
 
-void WebSocketSession::initAudio()
+// Called with queueMutex held
+auto WebSocketSession::queuedFrames() const -> int
 {
-  LOG("Initialize PulseAudio for audio capture");
-
-  pa_sample_spec ss;
-  ss.format = PA_SAMPLE_S16LE; // 16-bit PCM
-  ss.rate = 48000;             // 48kHz sample rate
-  ss.channels = 2;             // Stereo
-
-  pa_buffer_attr buffer_attr;
-  buffer_attr.maxlength = (uint32_t)-1; // Default maximum buffer size
-  buffer_attr.tlength = (uint32_t)-1;   // Not used for recording
-  buffer_attr.prebuf = (uint32_t)-1;    // Not used for recording
-  buffer_attr.minreq = (uint32_t)-1;    // Default minimum request size
-  buffer_attr.fragsize = 960;           // 0.005 seconds of audio (960 bytes)
-
-  int error;
-  paStream = pa_simple_new(NULL,             // Use default server
-                           "Screen Cast",    // Application name
-                           PA_STREAM_RECORD, // Stream direction (recording)
-#if 1
-                           "@DEFAULT_SINK@.monitor", // Source to record from
-#else
-                           nullptr,
-#endif
-                           "record",     // Stream description
-                           &ss,          // Sample format specification
-                           NULL,         // Default channel map
-                           &buffer_attr, // Buffer attributes
-                           &error        // Error code
-  );
-
-  if (!paStream)
-  {
-    LOG("pa_simple_new() failed:", pa_strerror(error));
-    exit(1);
-  }
-
-  int opusError;
-  opusEncoder = opus_encoder_create(ss.rate, ss.channels, OPUS_APPLICATION_AUDIO, &opusError);
-  if (opusError != OPUS_OK)
-  {
-    LOG("Failed to create Opus encoder:", opus_strerror(opusError));
-    exit(1);
-  }
-  opus_encoder_ctl(opusEncoder, OPUS_SET_BITRATE(opusBitrate));
+  return std::count_if(
+    std::begin(videoQueue), std::end(videoQueue), [](const auto &video) { return video.isFrameStart; });
 }
 
-auto WebSocketSession::startSendingFrames() -> void
+auto WebSocketSession::sendAudio(const MessageRef &message) -> void
 {
-  std::thread([self = shared_from_this()]() { self->videoThreadFunc(); }).detach();
-  std::thread([self = shared_from_this()]() { self->audioThreadFunc(); }).detach();
+  auto lock = std::unique_lock{queueMutex};
+  if (!isRunning || std::ssize(audioQueue) >= MaxQueuedAudio)
+    return;
+  audioQueue.push_back(message);
+  startWriting();
 }
 
-auto WebSocketSession::videoThreadFunc() -> void
+auto WebSocketSession::sendCursor(const MessageRef &message) -> void
 {
-  const auto display = XOpenDisplay(nullptr);
-  if (!display)
-  {
-    LOG("Cannot open display");
+  auto lock = std::unique_lock{queueMutex};
+  if (!isRunning)
     return;
-  }
+  (message->type() == 0x04 ? cursorShape : cursorPosition) = message;
+  startWriting();
+}
 
-  int displayHeight = DisplayHeight(display, 0);
+// Called with queueMutex held
+auto WebSocketSession::startWriting() -> void
+{
+  if (isWriting)
+    return;
+  const auto self = weak_from_this().lock();
+  if (!self)
+    return;
+  isWriting = true;
+  boost::asio::post(ws.get_executor(), [self]() { self->doWrite(); });
+}
 
-  auto root = DefaultRootWindow(display);
+auto WebSocketSession::stop() -> void
+{
+  auto lock = std::unique_lock{queueMutex};
+  isRunning = false;
+  controlQueue.clear();
+  cursorShape.reset();
+  cursorPosition.reset();
+  audioQueue.clear();
+  videoQueue.clear();
+}
 
-  GLint att[] = {GLX_RGBA, GLX_DEPTH_SIZE, 24, GLX_DOUBLEBUFFER, None};
-  XVisualInfo *vi = glXChooseVisual(display, 0, att);
-  if (!vi)
+auto WebSocketSession::doWrite() -> void
+{
+  auto lock = std::unique_lock{queueMutex};
+  if (!isRunning)
   {
-    LOG("No suitable visual found");
-    XCloseDisplay(display);
+    isWriting = false;
     return;
   }
-
-  GLXContext glc = glXCreateContext(display, vi, nullptr, GL_TRUE);
-  if (!glc)
+  // Control, cursor and audio messages are small and go first, so they never
+  // wait behind queued video
+  if (!controlQueue.empty())
   {
-    LOG("Cannot create OpenGL context");
-    XCloseDisplay(display);
-    return;
+    writing = std::move(controlQueue.front());
+    controlQueue.pop_front();
   }
-
-  glXMakeCurrent(display, root, glc);
-
-  auto rgb2yuv = Rgb2Yuv{8, width, height};
-
-  unsigned char *pixels = (uint8_t *)std::aligned_alloc(32, width * height * 3); // Aligned to 32 bytes
-
-  auto target = std::chrono::steady_clock::now() + std::chrono::milliseconds(1000 / 60);
-  while (isRunning)
+  else if (cursorShape)
+    writing = std::move(cursorShape);
+  else if (cursorPosition)
+    writing = std::move(cursorPosition);
+  else if (!audioQueue.empty())
   {
-    const auto t1 = std::chrono::steady_clock::now();
-
-    glReadBuffer(GL_FRONT);
-    glReadPixels(x, displayHeight - height + y, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
-    using namespace std::chrono_literals;
-    if (t1 > lastMouseEventFromClient + 1s)
-    {
-      const auto cursorImage = XFixesGetCursorImage(display);
-      if (cursorImage)
-      {
-        const auto cursorX = cursorImage->x - cursorImage->xhot - x;
-        const auto cursorY = cursorImage->y - cursorImage->yhot - y;
-
-        for (auto j = 0; j < cursorImage->height; ++j)
-        {
-          const auto imgY = cursorY + j;
-          if (imgY < 0 || imgY >= height)
-            continue;
-
-          for (auto i = 0; i < cursorImage->width; ++i)
-          {
-            const auto imgX = cursorX + i;
-            if (imgX < 0 || imgX >= width)
-              continue;
-
-            const auto cursorPixel = cursorImage->pixels[j * cursorImage->width + i];
-            const auto alpha = (cursorPixel >> 24) & 0xff;
-            if (alpha == 0)
-              continue;
-
-            const auto cr = static_cast<uint8_t>((cursorPixel >> 16) & 0xff);
-            const auto cg = static_cast<uint8_t>((cursorPixel >> 8) & 0xff);
-            const auto cb = static_cast<uint8_t>(cursorPixel & 0xff);
-
-            const auto imageIndex = ((height - imgY) * width + imgX) * 3;
-            if (imageIndex < 0 || imageIndex >= width * height * 3)
-              continue;
-
-            const auto ir = pixels[imageIndex];
-            const auto ig = pixels[imageIndex + 1];
-            const auto ib = pixels[imageIndex + 2];
-
-            const auto nr = static_cast<uint8_t>((cr * alpha + ir * (255 - alpha)) / 255);
-            const auto ng = static_cast<uint8_t>((cg * alpha + ig * (255 - alpha)) / 255);
-            const auto nb = static_cast<uint8_t>((cb * alpha + ib * (255 - alpha)) / 255);
-
-            pixels[imageIndex] = nr;
-            pixels[imageIndex + 1] = ng;
-            pixels[imageIndex + 2] = nb;
-          }
-        }
-      }
-      XFree(cursorImage);
-    }
-
-    const auto t2 = std::chrono::steady_clock::now();
-
-    const auto src = reinterpret_cast<const uint8_t *>(pixels);
-    const auto srcLineSize = width * 3;
-
-    uint8_t *dst[3] = {frame->data[0], frame->data[1], frame->data[2]};
-    int dstStride[3] = {frame->linesize[0], frame->linesize[1], frame->linesize[2]};
-    rgb2yuv.convert(src, srcLineSize, dst, dstStride);
-
-    const auto t3 = std::chrono::steady_clock::now();
-
-    frame->pts = frameIndex++;
-
-    if (encodeAndSendFrame() < 0)
-    {
-      LOG("Error encoding and sending frame");
-      break;
-    }
-    const auto t4 = std::chrono::steady_clock::now();
-
-    grabAcc += t2 - t1;
-    colorConvAcc += t3 - t2;
-    encAcc += t4 - t3;
-    ++benchCnt;
-
-    if (t4 > target)
-    {
-      LOG("Frame delayed",
-          std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(t4 - target),
-          "grab",
-          std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(t2 - t1),
-          "color conv",
-          std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(t3 - t2),
-          "encode",
-          std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(t4 - t3));
-      target = t4 + std::chrono::milliseconds(1000 / 60);
-    }
-    else
-    {
-      std::this_thread::sleep_for(target - t4);
-      target += std::chrono::milliseconds(1000 / 60);
-    }
+    writing = std::move(audioQueue.front());
+    audioQueue.pop_front();
   }
+  else if (!videoQueue.empty())
+  {
+    metrics->queueWait.record(std::chrono::duration_cast<std::chrono::microseconds>(
+                                std::chrono::steady_clock::now() - videoQueue.front().queuedAt)
+                                .count());
+    writing = std::move(videoQueue.front().message);
+    videoQueue.pop_front();
+  }
+  else
+  {
+    isWriting = false;
+    return;
+  }
+  writingBytes = writing->size();
+  lock.unlock();
+  writeStartedAt = std::chrono::steady_clock::now();
 
-  free(pixels);
-
-  glXDestroyContext(display, glc);
-  XCloseDisplay(display);
-
-  LOG("Video thread ended");
+  ws.binary(true);
+  ws.async_write(writing->buffers(),
+                 [self = shared_from_this()](boost::system::error_code ec, std::size_t) { self->onWrite(ec); });
 }
 
-auto WebSocketSession::encodeAndSendFrame() -> int
+auto WebSocketSession::onWrite(boost::system::error_code ec) -> void
 {
-  auto ret = avcodec_send_frame(codecContext, frame);
-  if (ret < 0)
+  if (!ec)
   {
-    LOG("Error sending a frame for encoding");
-    return ret;
+    const auto writeEnd = std::chrono::steady_clock::now();
+    metrics->socketWrite.record(std::chrono::duration_cast<std::chrono::microseconds>(writeEnd - writeStartedAt).count());
+    metrics->bytesSent.fetch_add(writing->size(), std::memory_order_relaxed);
+    if (writing->type() == 0x01)
+    {
+      const auto header = MediaHeader::read(*writing);
+      // Video carries its PTS, the trace id of its capture and encode spans
+      Trace::complete("ws write video", writeStartedAt, writeEnd, header.pts);
+      if (header.flags & 0x04)
+        latency.onFrameSent(header.sequence, header.captureTime);
+    }
+    else
+      Trace::complete(writing->type() == 0x02 ? "ws write audio" : "ws write", writeStartedAt, writeEnd);
   }
-
-  auto pkt = av_packet_alloc();
-  if (!pkt)
+  writing.reset();
   {
-    LOG("Could not allocate AVPacket");
-    return -1;
+    auto lock = std::unique_lock{queueMutex};
+    writingBytes = 0;
   }
-
-  while (ret >= 0)
+  if (ec)
   {
-    ret = avcodec_receive_packet(codecContext, pkt);
-    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-    {
-      av_packet_free(&pkt);
-      return 0;
-    }
-    else if (ret < 0)
-    {
-      LOG("Error during encoding");
-      av_packet_free(&pkt);
-      return ret;
-    }
-    if ((pkt->flags & AV_PKT_FLAG_KEY) && benchCnt > 0)
-    {
-      LOG("Benchmark cnt",
-          benchCnt,
-          "grab",
-          std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(grabAcc / benchCnt),
-          "colorConv",
-          std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(colorConvAcc / benchCnt),
-          "enc",
-          std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(encAcc / benchCnt));
-      grabAcc = {};
-      colorConvAcc = {};
-      encAcc = {};
-      benchCnt = 0;
-    }
-
-    try
-    {
-      // Prepend message type byte (0x01 for video)
-      std::vector<uint8_t> message;
-      message.push_back(0x01); // Video data identifier
-      message.insert(message.end(), pkt->data, pkt->data + pkt->size);
-
-      auto lock = std::unique_lock{avMutex};
-      ws.binary(true);
-      ws.write(boost::asio::buffer(message));
-    }
-    catch (const std::exception &e)
-    {
-      LOG("WebSocket write error:", e.what());
-      av_packet_unref(pkt);
-      av_packet_free(&pkt);
-      return -1;
-    }
-
-    av_packet_unref(pkt);
+    LOG("WebSocket write error:", ec.message());
+    stop();
   }
-
-  av_packet_free(&pkt);
-  return 0;
+  doWrite();
 }
 
-auto WebSocketSession::audioThreadFunc() -> void
+auto WebSocketSession::linkStats() -> LinkStats
 {
-  const size_t pcmBufferSize = 960 * 2 * sizeof(int16_t); // 960 samples per channel (5ms at 48kHz)
-  uint8_t pcmBuffer[pcmBufferSize];
-  const size_t opusMaxPacketSize = 4000;
-  uint8_t opusBuffer[opusMaxPacketSize];
-
-  while (isRunning)
-  {
-    int error;
-    if (pa_simple_read(paStream, pcmBuffer, pcmBufferSize, &error) < 0)
-    {
-      LOG("pa_simple_read() failed:", pa_strerror(error));
-      break;
-    }
+  auto lock = std::unique_lock{queueMutex};
+  auto ret = LinkStats{
+    .queuedVideo = queuedFrames(), .bytesInFlight = writingBytes, .rtt = rtt, .nDrops = std::exchange(nDrops, 0)};
+  for (const auto &message : audioQueue)
+    ret.bytesInFlight += message->size();
+  for (const auto &video : videoQueue)
+    ret.bytesInFlight += video.message->size();
+  // An unanswered ping is a lower bound for the current RTT
+  if (pingSentAt)
+    ret.rtt = std::max(
+      ret.rtt, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - *pingSentAt));
+  return ret;
+}
 
-    // Opus encode the PCM data
-    int opusDataSize = opus_encode(
-      opusEncoder, reinterpret_cast<int16_t *>(pcmBuffer), 960, opusBuffer, opusMaxPacketSize);
-    if (opusDataSize < 0)
+auto WebSocketSession::doPing() -> void
+{
+  using namespace std::chrono_literals;
+  pingTimer.expires_after(500ms);
+  pingTimer.async_wait([self = shared_from_this()](boost::system::error_code ec) {
+    if (ec || !self->isRunning)
+      return;
     {
-      LOG("Opus encoding failed:", opus_strerror(opusDataSize));
-      break;
+      auto lock = std::unique_lock{self->queueMutex};
+      // Still waiting for the previous pong
+      if (self->pingSentAt)
+      {
+        lock.unlock();
+        self->doPing();
+        return;
+      }
+      self->pingSentAt = std::chrono::steady_clock::now();
     }
+    self->ws.async_ping({}, [self](boost::system::error_code ec) {
+      if (ec)
+        LOG("WebSocket ping error:", ec.message());
+    });
+    self->sendClockProbe();
+    self->latency.maybeLog();
+    self->doPing();
+  });
+}
 
-    // Prepend message type byte (0x02 for audio)
-    std::vector<uint8_t> message;
-    message.push_back(0x02); // Audio data identifier
-    message.insert(message.end(), opusBuffer, opusBuffer + opusDataSize);
-
-    try
-    {
-      auto lock = std::unique_lock{avMutex};
-      ws.binary(true);
-      ws.write(boost::asio::buffer(message));
-    }
-    catch (const std::exception &e)
-    {
-      LOG("WebSocket write error (audio):", e.what());
-      break;
-    }
-  }
-  LOG("Audio thread ended");
+auto WebSocketSession::onControl(websocket::frame_type kind) -> void
+{
+  if (kind != websocket::frame_type::pong)
+    return;
+  auto lock = std::unique_lock{queueMutex};
+  if (!pingSentAt)
+    return;
+  rtt = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - *pingSentAt);
+  pingSentAt.reset();
 }
 
 auto WebSocketSession::doRead() -> void
@@ -457,13 +404,27 @@ auto WebSocketSession::doRead() -> void
 
 namespace
 {
+  // Client clock times in microseconds since the Unix epoch
+  struct FrameReport
+  {
+    uint32_t sequence;
+    int64_t receiveTime; // last part of the frame arrived
+    int64_t decodeTime;  // the decoder output the picture
+    int64_t presentTime; // first animation frame after it was drawn
+    SER_PROPS(sequence, receiveTime, decodeTime, presentTime);
+  };
+
   struct ClientMsg
   {
     std::string type;
     float x;
     float y;
     float deltaY;
-    SER_PROPS(type, x, y, deltaY);
+    std::vector<std::string> codecs; // codec negotiation: the names the client can decode
+    int64_t serverTime;              // clock probe reply
+    int64_t clientTime;
+    std::vector<FrameReport> frames; // frame timing reports
+    SER_PROPS(type, x, y, deltaY, codecs, serverTime, clientTime, frames);
   };
 } // namespace
 
@@ -473,11 +434,10 @@ auto WebSocketSession::onMessage(boost::system::error_code ec, std::size_t bytes
   if (ec)
   {
     if (ec == websocket::error::closed)
-    {
       LOG("WebSocket closed by client");
-      return;
-    }
-    LOG("WebSocket read error:", ec.message());
+    else
+      LOG("WebSocket read error:", ec.message());
+    stop();
     return;
   }
 
@@ -492,7 +452,24 @@ auto WebSocketSession::onMessage(boost::system::error_code ec, std::size_t bytes
       simulateMouseEvent(msg.type, msg.x, msg.y);
     else if (msg.type == "scroll")
       simulateScrollEvent(msg.deltaY);
-    lastMouseEventFromClient = std::chrono::steady_clock::now();
+    else if (msg.type == "keyframe")
+      onKeyframeRequest();
+    else if (msg.type == "clock")
+      latency.onClockReply(msg.serverTime, msg.clientTime);
+    else if (msg.type == "frames")
+      for (const auto &frame : msg.frames)
+        latency.onFrameReport(frame.sequence, frame.receiveTime, frame.decodeTime, frame.presentTime);
+    else if (msg.type == "codecs" && !isNegotiated)
+    {
+      const auto backend = VideoEncoder::negotiate(msg.codecs);
+      if (!backend)
+      {
+        LOG("The client cannot decode any of the offered codecs");
+        stop();
+        return;
+      }
+      startSendingFrames(*backend);
+    }
   }
   catch (const std::exception &e)
   {
@@ -502,7 +479,22 @@ auto WebSocketSession::onMessage(boost::system::error_code ec, std::size_t bytes
   doRead();
 }
 
-auto WebSocketSession::simulateMouseEvent(const std::string &type, int x, int y) -> void
+auto WebSocketSession::onKeyframeRequest() -> void
+{
+  if (!source)
+    return;
+  LOG("Client requested a keyframe");
+  {
+    // The client cannot decode anything before the keyframe
+    auto lock = std::unique_lock{queueMutex};
+    metrics->nFramesDropped.fetch_add(queuedFrames(), std::memory_order_relaxed);
+    videoQueue.clear();
+    isWaitingForKeyframe = true;
+  }
+  source->requestKeyframe();
+}
+
+auto WebSocketSession::simulateMouseEvent(const std::string &type, float x, float y) -> void
 {
   if (!display)
   {
@@ -510,16 +502,22 @@ auto WebSocketSession::simulateMouseEvent(const std::string &type, int x, int y)
     return;
   }
 
+  // The client sends coordinates in video pixels, which may be scaled from
+  // the captured area
+  const auto &c = config();
+  const auto screenX = c.captureX + static_cast<int>(x * c.captureWidth / c.width);
+  const auto screenY = c.captureY + static_cast<int>(y * c.captureHeight / c.height);
+
   if (type == "touchstart")
   {
-    XTestFakeMotionEvent(display, -1, x, y, CurrentTime);
+    XTestFakeMotionEvent(display, -1, screenX, screenY, CurrentTime);
     XTestFakeButtonEvent(display, 1, True, CurrentTime);
   }
   else if (type == "touchmove")
-    XTestFakeMotionEvent(display, -1, x, y, CurrentTime);
+    XTestFakeMotionEvent(display, -1, screenX, screenY, CurrentTime);
   else if (type == "touchend")
   {
-    XTestFakeMotionEvent(display, -1, x, y, CurrentTime);
+    XTestFakeMotionEvent(display, -1, screenX, screenY, CurrentTime);
     XTestFakeButtonEvent(display, 1, False, CurrentTime);
   }
 
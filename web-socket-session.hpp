@@ -1,20 +1,15 @@
 #pragma once
+#include "broadcast.hpp"
+#include "latency-probe.hpp"
+#include "metrics.hpp"
+#include "rate-controller.hpp"
 #include <X11/Xlib.h>
 #include <atomic>
 #include <boost/asio.hpp>
 #include <boost/beast.hpp>
+#include <deque>
 #include <log/log.hpp>
 #include <memory>
-#include <opus/opus.h>
-#include <thread>
-
-extern "C" {
-#include <libavcodec/avcodec.h>
-#include <libavutil/imgutils.h>
-#include <libavutil/opt.h>
-#include <pulse/error.h>
-#include <pulse/simple.h>
-}
 
 using tcp = boost::asio::ip::tcp;
 namespace http = boost::beast::http;
@@ -27,38 +22,80 @@ public:
   ~WebSocketSession();
   auto run(http::request<http::string_body> req) -> void;
 
+  // Called by the Broadcast on its pipeline threads. Messages are queued and
+  // written asynchronously on the session's strand, audio ahead of video, so
+  // a slow client only ever delays itself. Returns true if the client dropped
+  // video and needs a keyframe to resume. A sliced frame comes in several
+  // messages, only the first one has isFrameStart set.
+  auto sendVideo(const MessageRef &message, bool isKeyframe, bool isFrameStart) -> bool;
+  auto sendAudio(const MessageRef &message) -> void;
+  // Cursor messages go ahead of everything else; only the latest shape and
+  // the latest position are kept, older ones are obsolete
+  auto sendCursor(const MessageRef &message) -> void;
+  // Snapshot for the rate controller; the drop count restarts on every call
+  auto linkStats() -> LinkStats;
+
 private:
-  auto audioThreadFunc() -> void;
+  static constexpr auto MaxQueuedVideo = 4;  // frames, ~65 ms at 60 fps
+
+  struct QueuedVideo
+  {
+    MessageRef message;
+    bool isFrameStart;
+    std::chrono::steady_clock::time_point queuedAt;
+  };
+  static constexpr auto MaxQueuedAudio = 50; // ~1 s of 20 ms packets
+
+  auto doPing() -> void;
   auto doRead() -> void;
-  auto encodeAndSendFrame() -> int;
-  auto initAudio() -> void;
-  auto initEncoder() -> void;
+  auto doWrite() -> void;
+  auto onAccept(boost::system::error_code ec) -> void;
+  auto startWriting() -> void;
+  auto onControl(websocket::frame_type kind) -> void;
   auto onMessage(boost::system::error_code ec, std::size_t bytes_transferred) -> void;
-  auto simulateMouseEvent(const std::string &type, int x, int y) -> void;
+  auto onKeyframeRequest() -> void;
+  auto onWrite(boost::system::error_code ec) -> void;
+  auto queuedFrames() const -> int;
+  auto sendClockProbe() -> void;
+  auto sendConfig() -> void;
+  auto sendControl(const std::string &json) -> void;
+  auto simulateMouseEvent(const std::string &type, float x, float y) -> void;
   auto simulateScrollEvent(float deltaY) -> void;
-  auto startSendingFrames() -> void;
-  auto videoThreadFunc() -> void;
+  auto startSendingFrames(const VideoEncoder::Backend &backend) -> void;
+  auto stop() -> void;
 
+  // The socket is accepted on its own strand, so every handler of this
+  // session, reads and writes alike, is serialized on it
   websocket::stream<tcp::socket> ws;
-  AVCodec *codec = nullptr;
-  AVCodecContext *codecContext = nullptr;
-  AVFrame *frame = nullptr;
-  int frameIndex = 0;
-  const int width = 1920;
-  const int height = 1080;
-  const int x = 0;
-  const int y = 0;
-  pa_simple *paStream = nullptr;
   std::atomic<bool> isRunning = true;
-  std::mutex avMutex;
-  OpusEncoder *opusEncoder = nullptr;
-  int opusBitrate = 128'000;
-  decltype(std::chrono::steady_clock::now() - std::chrono::steady_clock::now()) grabAcc;
-  decltype(std::chrono::steady_clock::now() - std::chrono::steady_clock::now()) colorConvAcc;
-  decltype(std::chrono::steady_clock::now() - std::chrono::steady_clock::now()) encAcc;
-  int benchCnt = 0;
+  // Opened off the I/O threads once the handshake is done; input that
+  // arrives before is dropped
   Display *display = nullptr;
+  // The client named its codecs and the pipeline is being set up or running
+  bool isNegotiated = false;
   boost::beast::flat_buffer buffer;
   float deltaAcc = 0.f;
-  decltype(std::chrono::steady_clock::now()) lastMouseEventFromClient = {};
+  std::shared_ptr<Broadcast> source;
+  std::mutex queueMutex;
+  std::deque<MessageRef> controlQueue;
+  MessageRef cursorShape;
+  MessageRef cursorPosition;
+  std::deque<MessageRef> audioQueue;
+  std::deque<QueuedVideo> videoQueue;
+  // An async_write is in flight or posted; guarded by queueMutex
+  bool isWriting = false;
+  // Set until the first keyframe and after a drop; P-frames are useless then
+  bool isWaitingForKeyframe = true;
+  int writingBytes = 0;
+  int nDrops = 0;
+  // Message being written, only touched on the socket's strand
+  MessageRef writing;
+  std::chrono::steady_clock::time_point writeStartedAt;
+  const std::shared_ptr<SessionMetrics> metrics = registerSession();
+  // RTT is measured with WebSocket pings, which browsers answer on their own
+  boost::asio::steady_timer pingTimer;
+  std::optional<std::chrono::steady_clock::time_point> pingSentAt; // guarded by queueMutex
+  std::chrono::microseconds rtt = {};                              // guarded by queueMutex
+  // Clock probes go out with the pings; only touched on the socket's strand
+  LatencyProbe latency;
 };
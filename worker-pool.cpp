@@ -0,0 +1,132 @@
+#include "worker-pool.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cassert>
+#include <immintrin.h>
+#include <pthread.h>
+
+namespace
+{
+  // About 50-200 us since Skylake, where a pause takes 40-140 cycles (100 us
+  // measured on a recent Xeon), and less on older cores: covers back-to-back
+  // jobs, but idle threads go to sleep well before the next frame is due
+  constexpr auto SpinCount = 4096;
+
+  auto sharedThreads = -1;
+  auto sharedCpus = std::vector<int>{};
+
+  template <typename T>
+  auto spinThenWait(const std::atomic<T> &value, T old) -> T
+  {
+    for (auto i = 0; i < SpinCount; ++i)
+    {
+      const auto v = value.load(std::memory_order_acquire);
+      if (v != old)
+        return v;
+      _mm_pause();
+    }
+    value.wait(old, std::memory_order_acquire);
+    return value.load(std::memory_order_acquire);
+  }
+
+  constexpr auto unpackJob(uint64_t ticket) { return static_cast<uint32_t>(ticket >> 32); }
+  constexpr auto unpackTasks(uint64_t ticket) { return static_cast<int>((ticket >> 16) & 0xffff); }
+  constexpr auto unpackIndex(uint64_t ticket) { return static_cast<int>(ticket & 0xffff); }
+} // namespace
+
+WorkerPool::WorkerPool(int nThreads, const std::vector<int> &cpus)
+{
+  for (auto i = 0; i < nThreads; ++i)
+    threads.emplace_back(&WorkerPool::worker, this, cpus.empty() ? -1 : cpus[i % cpus.size()]);
+}
+
+WorkerPool::~WorkerPool()
+{
+  stop = true;
+  generation.fetch_add(1, std::memory_order_release);
+  generation.notify_all();
+  for (auto &t : threads)
+    t.join();
+}
+
+auto WorkerPool::configure(int nThreads, std::vector<int> cpus) -> void
+{
+  sharedThreads = nThreads;
+  sharedCpus = std::move(cpus);
+}
+
+auto WorkerPool::shared() -> WorkerPool &
+{
+  static auto inst = WorkerPool{sharedThreads < 0 ? defaultThreads() : sharedThreads, sharedCpus};
+  return inst;
+}
+
+auto WorkerPool::defaultThreads() -> int
+{
+  // The submitting thread works too; beyond 8 threads conversion is memory bound
+  return std::clamp(static_cast<int>(std::thread::hardware_concurrency()), 1, 8) - 1;
+}
+
+auto WorkerPool::runTasks(int nTasks, void (*aFn)(void *, int), void *aCtx) -> void
+{
+  assert(nTasks < 0x8000);
+  if (nTasks <= 0)
+    return;
+
+  while (busy.test_and_set(std::memory_order_acquire))
+    busy.wait(true, std::memory_order_relaxed);
+
+  fn = aFn;
+  ctx = aCtx;
+  remaining.store(nTasks, std::memory_order_relaxed);
+  const auto job = unpackJob(ticket.load(std::memory_order_relaxed)) + 1;
+  ticket.store(static_cast<uint64_t>(job) << 32 | static_cast<uint64_t>(nTasks) << 16,
+               std::memory_order_release);
+  generation.fetch_add(1, std::memory_order_release);
+  generation.notify_all();
+
+  work();
+
+  for (auto left = remaining.load(std::memory_order_acquire); left != 0;
+       left = remaining.load(std::memory_order_acquire))
+    spinThenWait(remaining, left);
+
+  busy.clear(std::memory_order_release);
+  busy.notify_one();
+}
+
+auto WorkerPool::work() -> void
+{
+  for (;;)
+  {
+    const auto t = ticket.fetch_add(1, std::memory_order_acq_rel);
+    const auto i = unpackIndex(t);
+    if (i >= unpackTasks(t))
+      return;
+    // The job cannot finish before this task does, so fn and ctx still belong to it
+    fn(ctx, i);
+    if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      remaining.notify_one();
+  }
+}
+
+auto WorkerPool::worker(int cpu) -> void
+{
+  Trace::setThreadName("worker");
+  if (cpu >= 0)
+  {
+    auto cpuSet = cpu_set_t{};
+    CPU_ZERO(&cpuSet);
+    CPU_SET(cpu, &cpuSet);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+  }
+
+  auto seen = generation.load(std::memory_order_acquire);
+  for (;;)
+  {
+    seen = spinThenWait(generation, seen);
+    if (stop)
+      return;
+    work();
+  }
+}
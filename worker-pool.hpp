@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of threads that run data-parallel jobs split into independent tasks.
+// Workers and the submitting thread pull task indices from a shared counter, so
+// a slow thread simply ends up taking fewer tasks. Idle threads spin briefly
+// before sleeping on a futex, which keeps the wake-up latency for back-to-back
+// jobs low without burning a core between frames.
+class WorkerPool
+{
+public:
+  // cpus, if not empty, is the list of CPUs the workers are pinned to round-robin
+  WorkerPool(int nThreads, const std::vector<int> &cpus = {});
+  ~WorkerPool();
+
+  // Sets up the process-wide pool; must be called before the first shared()
+  static auto configure(int nThreads, std::vector<int> cpus) -> void;
+  static auto shared() -> WorkerPool &;
+  // Default number of worker threads for this machine
+  static auto defaultThreads() -> int;
+
+  // Runs task(i) for every i in [0, nTasks) and returns when all of them
+  // finished. The calling thread takes part in the work. Concurrent callers
+  // are serialized.
+  template <typename F>
+  auto run(int nTasks, F &&task) -> void
+  {
+    using Task = std::remove_cvref_t<F>;
+    runTasks(
+      nTasks, [](void *ctx, int i) { (*static_cast<Task *>(ctx))(i); }, const_cast<Task *>(&task));
+  }
+
+private:
+  auto runTasks(int nTasks, void (*fn)(void *, int), void *ctx) -> void;
+  auto worker(int cpu) -> void;
+  auto work() -> void;
+
+  std::vector<std::thread> threads;
+  std::atomic_flag busy;
+  // Job id, task count and next task index packed together, so a thread that
+  // claims an index also learns which job it belongs to
+  std::atomic<uint64_t> ticket = 0;
+  std::atomic<uint32_t> generation = 0;
+  std::atomic<int> remaining = 0;
+  void (*fn)(void *, int) = nullptr;
+  void *ctx = nullptr;
+  std::atomic<bool> stop = false;
+};
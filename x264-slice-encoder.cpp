@@ -0,0 +1,203 @@
+#include "x264-slice-encoder.hpp"
+#include "config.hpp"
+#include "trace.hpp"
+#include <log/log.hpp>
+
+X264SliceEncoder::X264SliceEncoder(
+  const char *profile, int width, int height, int crf, int sliceSize, OnNal onNal)
+  : onNal(std::move(onNal)),
+    nMbs(((width + 15) / 16) * ((height + 15) / 16)),
+    // Room for x264_nal_encode() at the slice size limit, see acquirePacket()
+    bufferSize(sliceSize * 3 / 2 + 5 + 64),
+    bufferPool(av_buffer_pool_init(bufferSize + AV_INPUT_BUFFER_PADDING_SIZE, nullptr))
+{
+  LOG("Initialize sliced x264 encoder,", profile, "profile, CRF", crf, "slices up to", sliceSize, "bytes");
+
+  x264_param_default_preset(&param, "ultrafast", "zerolatency");
+  param.i_width = width;
+  param.i_height = height;
+  param.i_csp = X264_CSP_I420;
+  param.i_fps_num = config().fps;
+  param.i_fps_den = 1;
+  // PTS are capture times in microseconds
+  param.i_timebase_num = 1;
+  param.i_timebase_den = 1'000'000;
+  param.i_keyint_max = 2000;
+  if (config().intraRefresh)
+  {
+    param.b_intra_refresh = 1;
+    param.i_keyint_max = config().fps;
+  }
+  param.rc.i_rc_method = X264_RC_CRF;
+  param.rc.f_rf_constant = crf;
+  // ultrafast turns these off; apply_profile turns them off again for baseline
+  param.b_cabac = 1;
+  param.analyse.b_transform_8x8 = 1;
+  param.b_repeat_headers = 1;
+  param.b_annexb = 1;
+  // zerolatency already encodes the slices of a frame in parallel threads
+  param.b_sliced_threads = 1;
+  param.i_slice_max_size = sliceSize;
+  param.nalu_process = onNalProcess;
+  if (x264_param_apply_profile(&param, profile) < 0)
+  {
+    LOG("Unknown x264 profile:", profile);
+    exit(1);
+  }
+
+  if (!bufferPool)
+  {
+    LOG("Could not allocate the NAL unit pool");
+    exit(1);
+  }
+
+  encoder = x264_encoder_open(&param);
+  if (!encoder)
+  {
+    LOG("Could not open x264");
+    exit(1);
+  }
+}
+
+X264SliceEncoder::~X264SliceEncoder()
+{
+  x264_encoder_close(encoder);
+  for (auto &[firstMb, slice] : pending)
+    av_packet_free(&slice.first);
+  for (auto &pkt : freePackets)
+    av_packet_free(&pkt);
+  // Freed once the last payload still queued for a client comes back
+  av_buffer_pool_uninit(&bufferPool);
+}
+
+auto X264SliceEncoder::setCrf(int crf) -> void
+{
+  if (param.rc.f_rf_constant == crf)
+    return;
+  param.rc.f_rf_constant = crf;
+  x264_encoder_reconfig(encoder, &param);
+}
+
+auto X264SliceEncoder::encode(AVFrame *frame, bool isKeyframe) -> int
+{
+  {
+    auto lock = std::unique_lock{mutex};
+    nextMb = 0;
+    isFrameEnded = false;
+    pts = frame->pts;
+  }
+
+  auto pic = x264_picture_t{};
+  x264_picture_init(&pic);
+  pic.img.i_csp = X264_CSP_I420;
+  pic.img.i_plane = 3;
+  for (auto i = 0; i < 3; ++i)
+  {
+    pic.img.plane[i] = frame->data[i];
+    pic.img.i_stride[i] = frame->linesize[i];
+  }
+  pic.i_pts = frame->pts;
+  pic.i_type = isKeyframe ? X264_TYPE_IDR : X264_TYPE_AUTO;
+  pic.opaque = this;
+
+  auto nals = static_cast<x264_nal_t *>(nullptr);
+  auto nNals = 0;
+  auto picOut = x264_picture_t{};
+  const auto ret = [&]() {
+    const auto span = TraceSpan{"x264 encode", frame->pts};
+    return x264_encoder_encode(encoder, &nals, &nNals, &pic, &picOut);
+  }();
+
+  // Slices should cover every macroblock; if they did not, send what is there
+  // so the client is not left with an unfinished frame
+  auto lock = std::unique_lock{mutex};
+  while (!pending.empty())
+  {
+    const auto slice = pending.begin()->second;
+    pending.erase(std::begin(pending));
+    emit(slice.first, pending.empty());
+  }
+  return ret;
+}
+
+auto X264SliceEncoder::onNalProcess(x264_t *h, x264_nal_t *nal, void *opaque) -> void
+{
+  const auto self = static_cast<X264SliceEncoder *>(opaque);
+  // Runs on x264's slice threads, whose spans show how they share the cores
+  Trace::setThreadName("x264 slice");
+  const auto span = TraceSpan{"x264 nal", nal->i_first_mb};
+
+  // x264_nal_encode() adds start codes and emulation prevention bytes
+  const auto pkt = self->acquirePacket(nal->i_payload * 3 / 2 + 5 + 64);
+  x264_nal_encode(h, pkt->data, nal);
+  av_shrink_packet(pkt, nal->i_payload);
+  if (nal->i_type == NAL_SLICE_IDR || nal->i_type == NAL_SPS || nal->i_type == NAL_PPS)
+    pkt->flags |= AV_PKT_FLAG_KEY;
+
+  auto lock = std::unique_lock{self->mutex};
+  pkt->pts = self->pts;
+  pkt->dts = self->pts;
+  if (nal->i_type != NAL_SLICE && nal->i_type != NAL_SLICE_IDR)
+  {
+    // Headers and SEI are written before the slice threads start
+    self->emit(pkt, false);
+    return;
+  }
+  self->pending[nal->i_first_mb] = {pkt, nal->i_last_mb};
+  while (!self->pending.empty() && self->pending.begin()->first == self->nextMb)
+  {
+    const auto [slice, lastMb] = self->pending.begin()->second;
+    self->pending.erase(std::begin(self->pending));
+    self->nextMb = lastMb + 1;
+    self->emit(slice, self->nextMb >= self->nMbs);
+  }
+}
+
+auto X264SliceEncoder::acquirePacket(int size) -> AVPacket *
+{
+  const auto pkt = [&]() {
+    auto lock = std::unique_lock{mutex};
+    if (freePackets.empty())
+      return av_packet_alloc();
+    const auto ret = freePackets.back();
+    freePackets.pop_back();
+    return ret;
+  }();
+  if (!pkt)
+  {
+    LOG("Could not allocate NAL unit");
+    exit(1);
+  }
+  // Larger NAL units, like a macroblock that alone exceeds the slice size,
+  // are rare enough to get a payload of their own
+  if (size > bufferSize)
+  {
+    if (av_new_packet(pkt, size) < 0)
+    {
+      LOG("Could not allocate NAL unit");
+      exit(1);
+    }
+    return pkt;
+  }
+  pkt->buf = av_buffer_pool_get(bufferPool);
+  if (!pkt->buf)
+  {
+    LOG("Could not allocate NAL unit");
+    exit(1);
+  }
+  pkt->data = pkt->buf->data;
+  pkt->size = size;
+  return pkt;
+}
+
+// Called with mutex held
+auto X264SliceEncoder::emit(AVPacket *pkt, bool isFrameEnd) -> void
+{
+  if (!isFrameEnded)
+  {
+    isFrameEnded = isFrameEnd;
+    onNal(pkt, isFrameEnd);
+  }
+  av_packet_unref(pkt);
+  freePackets.push_back(pkt);
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <x264.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+// H.264 encoder on the native x264 API that hands out every NAL unit as soon
+// as x264 finishes it, instead of one packet per frame. With slice-max-size
+// and sliced threads the first slices of a frame are on the wire while the
+// rest are still being encoded.
+class X264SliceEncoder
+{
+public:
+  // Called with the NAL units of a frame in bitstream order, possibly from
+  // x264's slice threads but never concurrently; the receiver may move the
+  // packet data out. isFrameEnd is set on the last slice of the frame.
+  using OnNal = std::function<void(AVPacket *pkt, bool isFrameEnd)>;
+
+  X264SliceEncoder(const char *profile, int width, int height, int crf, int sliceSize, OnNal onNal);
+  ~X264SliceEncoder();
+
+  auto setCrf(int crf) -> void;
+  // Returns once every NAL unit of the frame went to onNal; negative on error.
+  // The frame's pts is in microseconds.
+  auto encode(AVFrame *frame, bool isKeyframe) -> int;
+
+private:
+  static auto onNalProcess(x264_t *h, x264_nal_t *nal, void *opaque) -> void;
+  // A blank packet with a payload of size bytes
+  auto acquirePacket(int size) -> AVPacket *;
+  auto emit(AVPacket *pkt, bool isFrameEnd) -> void;
+
+  OnNal onNal;
+  x264_param_t param;
+  x264_t *encoder = nullptr;
+  const int nMbs;
+  // Payloads for NAL units up to bufferSize bytes; receivers hold on to them
+  // until they are sent and the pool outlives the encoder until they are back
+  const int bufferSize;
+  AVBufferPool *bufferPool = nullptr;
+  std::mutex mutex;
+  // Packets whose payload went to onNal, reused for the next NAL units
+  std::vector<AVPacket *> freePackets;
+  // Slices finished out of order by the slice threads, keyed by their first
+  // macroblock, with their last one
+  std::map<int, std::pair<AVPacket *, int>> pending;
+  int nextMb = 0;
+  int64_t pts = 0; // of the frame being encoded
+  bool isFrameEnded = false;
+};